@@ -0,0 +1,319 @@
+#include <QApplication>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <chrono>
+#include <complex>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "config.hh"
+#include "ffmpeg.hh"
+#include "libda/fft.hpp"
+#include "notegraphwidget.hh"
+#include "notelabel.hh"
+#include "pitch.hh"
+#include "pitchpaths.hh"
+#include "signals.hh"
+#include "song.hh"
+#include "songwriter.hh"
+
+/**
+ * Performance regression benchmarks.
+ *
+ * composer-bench [--filter TEXT] [--min-time SECONDS] [--output FILE] [MUSIC...]
+ *
+ * All inputs are generated in-process from fixed seeds so that runs are
+ * comparable between releases. Music files given as arguments are also
+ * analyzed from start to end. The results are written as JSON.
+ */
+
+namespace {
+	using Signals::rate;
+	using Signals::noise;
+
+	std::vector<float> harmonic(double seconds) { return Signals::tone(seconds, Signals::steady(220.0)); }
+	std::vector<float> glide(double seconds) { return Signals::tone(seconds, Signals::glide(110.0, 880.0, seconds)); }
+	std::vector<float> vibrato(double seconds) { return Signals::tone(seconds, Signals::vibrato(330.0)); }
+
+	struct Result {
+		std::string name;
+		double seconds;  ///< Time per iteration
+		unsigned iterations;
+		double throughput;  ///< Work done per second
+		std::string unit;
+		std::string error;  ///< Empty unless the case failed
+	};
+
+	std::string jsonString(std::string const& str) {
+		std::string ret = "\"";
+		for (char c: str) {
+			if (c == '"' || c == '\\') ret += '\\';
+			if (static_cast<unsigned char>(c) >= 0x20) ret += c;
+		}
+		return ret + "\"";
+	}
+
+	class Bench {
+	public:
+		Bench(): minTime(0.5) {}
+		std::string filter;  ///< Only run the cases whose names contain this
+		double minTime;  ///< Minimum measurement time for each case (seconds)
+		/// Time fn (after a warm-up call) until minTime has passed, work is the amount of unit one call processes
+		void run(std::string const& name, double work, std::string const& unit, std::function<void ()> const& fn) {
+			if (name.find(filter) == std::string::npos) return;
+			Result r = { name, 0.0, 0, 0.0, unit, "" };
+			try {
+				fn();
+				typedef std::chrono::steady_clock Clock;
+				Clock::time_point begin = Clock::now();
+				double elapsed = 0.0;
+				do {
+					fn();
+					++r.iterations;
+					elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+				} while (elapsed < minTime);
+				r.seconds = elapsed / r.iterations;
+				r.throughput = work / r.seconds;
+			} catch (std::exception& e) {
+				r.error = e.what();
+			}
+			std::cerr << name << ": ";
+			if (r.error.empty()) std::cerr << r.throughput << " " << unit << std::endl;
+			else std::cerr << "FAILED: " << r.error << std::endl;
+			m_results.push_back(r);
+		}
+		void write(std::ostream& os) const {
+			os << "{\n\t\"version\": " << jsonString(VERSION) << ",\n\t\"results\": [";
+			for (std::size_t i = 0; i < m_results.size(); ++i) {
+				Result const& r = m_results[i];
+				os << (i ? ",\n" : "\n") << "\t\t{ \"name\": " << jsonString(r.name) << ", \"seconds\": " << r.seconds
+				  << ", \"iterations\": " << r.iterations << ", \"throughput\": " << r.throughput
+				  << ", \"unit\": " << jsonString(r.unit);
+				if (!r.error.empty()) os << ", \"error\": " << jsonString(r.error);
+				os << " }";
+			}
+			os << "\n\t]\n}\n";
+		}
+		bool failed() const {
+			return std::any_of(m_results.begin(), m_results.end(), [](Result const& r) { return !r.error.empty(); });
+		}
+	private:
+		std::vector<Result> m_results;
+	};
+
+	template <unsigned P> void benchFFT(Bench& bench) {
+		std::vector<float> pcm = noise(double(1 << P) / rate);
+		std::vector<std::complex<float> > input(pcm.begin(), pcm.end()), data;
+		bench.run("fft/" + std::to_string(1 << P), 1.0, "FFT/s", [&]() {
+			data = input;  // Transformed in place
+			da::fft<P>(&data[0]);
+		});
+	}
+
+	void benchAnalyzer(Bench& bench, std::string const& name, std::vector<float> const& pcm) {
+		for (PitchEngine::Type type: { PitchEngine::HARMONIC, PitchEngine::YIN }) {
+			bench.run("analyzer/" + std::string(PitchEngine::name(type)) + "/" + name, double(pcm.size()) / rate, "audio s/s", [&]() {
+				std::unique_ptr<PitchEngine> analyzer = PitchEngine::create(type, rate);
+				for (std::size_t x = 0; x + analyzer->processSize() <= pcm.size(); x += analyzer->processStep()) {
+					analyzer->process(pcm.begin() + x);
+				}
+			});
+		}
+	}
+
+	/// The harmonic engine at each FFT size (the default step scaled along)
+	void benchResolutions(Bench& bench, std::vector<float> const& pcm) {
+		for (unsigned p = AnalyzerConfig::MIN_FFT_P; p <= AnalyzerConfig::MAX_FFT_P; ++p) {
+			AnalyzerConfig config(p, (1u << p) / 8);
+			bench.run("analyzer/harmonic/fft" + std::to_string(1 << p), double(pcm.size()) / rate, "audio s/s", [&]() {
+				Analyzer analyzer(rate, "", config);
+				for (std::size_t x = 0; x + analyzer.processSize() <= pcm.size(); x += analyzer.processStep()) {
+					analyzer.process(pcm.begin() + x);
+				}
+			});
+		}
+	}
+
+	void benchAudioQueue(Bench& bench) {
+		std::vector<float> pcm = noise(10.0);  // As if stereo 48 kHz for five seconds
+		const std::size_t chunk = 4096;
+		std::vector<float> out;
+		out.reserve(pcm.size());
+		bench.run("audioqueue", pcm.size(), "samples/s", [&]() {
+			AudioQueue queue;
+			queue.setRateChannels(rate, 2);
+			std::thread producer([&]() {
+				for (std::size_t pos = 0; pos < pcm.size(); pos += chunk) {
+					queue.input(pcm.begin() + pos, pcm.begin() + std::min(pos + chunk, pcm.size()), 1.0);
+				}
+				queue.setEof();
+			});
+			out.clear();
+			while (queue.output(out)) {}
+			producer.join();
+			if (out.size() != pcm.size()) throw std::runtime_error("AudioQueue lost samples");
+		});
+	}
+
+	/// Notes of a regular melody, eight notes per sentence
+	VocalTrack melody(unsigned count) {
+		VocalTrack track(TrackName::LEAD_VOCAL);
+		for (unsigned i = 0; i < count; ++i) {
+			Note n(i % 2 ? "la" : "lo");
+			n.type = (i % 16 == 15 ? Note::GOLDEN : Note::NORMAL);
+			n.begin = 1.0 + 0.5 * i;
+			n.end = n.begin + 0.375;
+			n.note = n.notePrev = 48 + (i * 7) % 24;
+			n.lineBreak = i % 8 == 0;
+			track.notes.push_back(n);
+		}
+		track.noteMin = 48;
+		track.noteMax = 71;
+		track.beginTime = track.notes.front().begin;
+		track.endTime = track.notes.back().end;
+		return track;
+	}
+
+	void benchFormats(Bench& bench) {
+		const unsigned count = 1000;
+		QTemporaryDir tmp;
+		if (!tmp.isValid()) throw std::runtime_error("Cannot create a temporary folder");
+		Song song;
+		song.title = "Benchmark";
+		song.artist = PACKAGE;
+		song.bpm = 120.0;
+		song.insertVocalTrack(TrackName::LEAD_VOCAL, melody(count));
+
+		struct Format {
+			std::string name;
+			QString file;  ///< Written by writer and parsed back, empty if there is no parser for the format
+			std::function<void (Song const&, QString const&)> writer;
+		};
+		std::vector<Format> formats = {
+			{ "xml", "notes.xml", [](Song const& s, QString const& dir) { SingStarXMLWriter(s, dir); } },
+			{ "txt", "notes.txt", [](Song const& s, QString const& dir) { UltraStarTXTWriter(s, dir); } },
+			{ "ini", "song.ini", [](Song const& s, QString const& dir) { FoFMIDIWriter(s, dir); } },
+			{ "lrc", "song.lrc", [](Song const& s, QString const& dir) { LRCWriter(s, dir, false); } },
+			{ "elrc", "", [](Song const& s, QString const& dir) { LRCWriter(s, dir, true); } },
+			{ "smm", "", [](Song const& s, QString const& dir) { SMMWriter(s, dir); } },
+		};
+		for (Format const& f: formats) {
+			QString dir = tmp.path() + "/" + QString::fromStdString(f.name);
+			bench.run("writer/" + f.name, count, "notes/s", [&]() { f.writer(song, dir); });
+			if (f.file.isEmpty() || !QFileInfo(dir + "/" + f.file).exists()) continue;
+			bench.run("parser/" + f.name, count, "notes/s", [&]() {
+				Song parsed(dir + "/", f.file);
+				if (parsed.getVocalTrack().notes.empty()) throw std::runtime_error("No notes parsed");
+			});
+		}
+	}
+
+	/// Exposes the full layout that the editor does after zooming or loading
+	class LayoutWidget: public NoteGraphWidget {
+	public:
+		void relayout() { invalidateLayout(); updateNotes(); }
+	};
+
+	void benchNoteGraph(Bench& bench, unsigned count) {
+		std::string suffix = "/" + std::to_string(count);
+		VocalTrack track = melody(count);
+		LayoutWidget widget;
+		widget.resize(1280, widget.height());
+		bench.run("notegraph/setLyrics" + suffix, count, "notes/s", [&]() { widget.setLyrics(track); });
+		bench.run("notegraph/updateNotes" + suffix, count, "notes/s", [&]() { widget.relayout(); });
+		// Drag one note back and forth in the middle of the song (incremental layout)
+		int id = widget.noteLabels().size() / 2;
+		bool forward = true;
+		bench.run("notegraph/move" + suffix, 1.0, "moves/s", [&]() {
+			Note const& n = widget.noteLabels()[id]->note();
+			double delta = forward ? 0.05 : -0.05;
+			widget.doOperation(Operation::move(id, n.begin + delta, n.end + delta, n.note));
+			forward = !forward;
+		});
+	}
+
+	void benchMusic(Bench& bench, QString const& file) {
+		std::string name = file.toLocal8Bit().data();
+		double seconds = 0.0;
+		// Decoding is included, the length is only known after the first run
+		PitchPaths paths;
+		analyzePitch(name, paths, PitchEngine::HARMONIC, AnalyzerConfig(), [&seconds](double position, double) { seconds = position; return true; });
+		bench.run("analyze/" + QFileInfo(file).fileName().toStdString(), seconds, "audio s/s", [&]() {
+			PitchPaths paths;
+			analyzePitch(name, paths);
+		});
+		// As in the editor, the preview pass and then the full resolution
+		bench.run("analyze-progressive/" + QFileInfo(file).fileName().toStdString(), seconds, "audio s/s", [&]() {
+			analyzePitchProgressive(name, [](PitchPaths&) {});
+		});
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	// Widgets are laid out without showing them
+	qputenv("QT_QPA_PLATFORM", "offscreen");
+	QApplication app(argc, argv);
+	app.setApplicationName(PACKAGE);
+
+	Bench bench;
+	QString output;
+	QStringList music;
+	QStringList args = app.arguments();
+	for (int i = 1; i < args.size(); ++i) {
+		bool hasValue = i + 1 < args.size();
+		if (args[i] == "--filter" && hasValue) bench.filter = args[++i].toStdString();
+		else if (args[i] == "--min-time" && hasValue) bench.minTime = args[++i].toDouble();
+		else if (args[i] == "--output" && hasValue) output = args[++i];
+		else if (args[i].startsWith("-")) {
+			bool help = args[i] == "--help" || args[i] == "-h";
+			(help ? std::cout : std::cerr) << "composer-bench [--filter TEXT] [--min-time SECONDS] [--output FILE] [MUSIC...]" << std::endl;
+			return help ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+		else music << args[i];
+	}
+
+	benchFFT<8>(bench);
+	benchFFT<10>(bench);
+	benchFFT<12>(bench);
+	benchFFT<14>(bench);
+	benchAnalyzer(bench, "harmonic", harmonic(10.0));
+	benchAnalyzer(bench, "glide", glide(10.0));
+	benchAnalyzer(bench, "vibrato", vibrato(10.0));
+	benchAnalyzer(bench, "noise", noise(10.0));
+	benchResolutions(bench, vibrato(10.0));
+	benchAudioQueue(bench);
+	try {
+		benchFormats(bench);
+	} catch (std::exception& e) {
+		std::cerr << "Formats: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	benchNoteGraph(bench, 1000);
+	benchNoteGraph(bench, 10000);
+	for (QString const& file: music) {
+		try {
+			benchMusic(bench, file);
+		} catch (std::exception& e) {
+			std::cerr << file.toStdString() << ": " << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (output.isEmpty()) bench.write(std::cout);
+	else {
+		std::ofstream os(output.toLocal8Bit().data());
+		bench.write(os);
+		if (!os) {
+			std::cerr << "Cannot write " << output.toStdString() << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	return bench.failed() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,170 @@
+#include <QApplication>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "config.hh"
+#include "notegraphwidget.hh"
+#include "notelabel.hh"
+#include "operation.hh"
+
+/**
+ * Incremental note layout check.
+ *
+ * composer-layoutcheck [--seed N] [--steps N]
+ *
+ * Applies random edits (inserts, deletes, moves, floating toggles and layout
+ * direction changes) to a note graph. After each edit, the incremental layout
+ * that the editor does is compared with a full layout of the same notes. The
+ * two must be identical, so the exit status is non-zero on the first
+ * difference.
+ */
+
+namespace {
+	/// Exposes the layout of the whole song next to the incremental one
+	class LayoutWidget: public NoteGraphWidget {
+	public:
+		void relayout(bool leftToRight) { invalidateLayout(); updateNotes(leftToRight); }
+	};
+
+	struct NoteState {
+		double begin, end;
+		int note;
+		bool floating;
+		bool operator!=(NoteState const& other) const {
+			return begin != other.begin || end != other.end || note != other.note || floating != other.floating;
+		}
+	};
+
+	std::vector<NoteState> snapshot(LayoutWidget const& widget) {
+		std::vector<NoteState> ret;
+		for (NoteLabel const* label: widget.noteLabels()) {
+			Note const& n = label->note();
+			ret.push_back(NoteState{ n.begin, n.end, n.note, label->isFloating() });
+		}
+		return ret;
+	}
+
+	/// Index of the first difference between a and b, -1 if they are identical
+	int difference(std::vector<NoteState> const& a, std::vector<NoteState> const& b) {
+		if (a.size() != b.size()) return std::min(a.size(), b.size());
+		for (std::size_t i = 0; i < a.size(); ++i) if (a[i] != b[i]) return i;
+		return -1;
+	}
+
+	void print(std::ostream& os, char const* title, std::vector<NoteState> const& notes, int around) {
+		os << title << ":" << std::endl;
+		for (int i = std::max(0, around - 3); i < std::min<int>(notes.size(), around + 4); ++i) {
+			NoteState const& n = notes[i];
+			os.precision(17);
+			os << "  " << i << ": " << n.begin << " - " << n.end << " note " << n.note << (n.floating ? " floating" : "") << std::endl;
+		}
+	}
+
+	/// Notes of a short song, every third one fixed
+	void createSong(LayoutWidget& widget, std::mt19937& random) {
+		std::uniform_real_distribution<double> length(0.1, 0.6), pause(0.0, 0.4);
+		std::uniform_int_distribution<int> pitch(48, 72);
+		double t = 1.0;
+		widget.beginBatch();
+		for (int i = 0; i < 60; ++i) {
+			Note n("la");
+			n.begin = t;
+			n.end = t + length(random);
+			n.note = n.notePrev = pitch(random);
+			t = n.end + pause(random);
+			widget.doOperation(Operation::newNote(i, n, i % 3 != 0), Operation::NO_EMIT);
+		}
+		widget.commitBatch();
+	}
+
+	/// Apply one random edit with the incremental layout in the direction given
+	std::string randomEdit(LayoutWidget& widget, std::mt19937& random, bool leftToRight) {
+		NoteLabels const& notes = widget.noteLabels();
+		int count = notes.size();
+		std::uniform_int_distribution<int> kind(0, 3), pitch(48, 72);
+		std::uniform_real_distribution<double> unit(0.0, 1.0);
+		int id = count ? std::uniform_int_distribution<int>(0, count - 1)(random) : 0;
+		Operation op;
+		switch (count ? kind(random) : 0) {
+		case 0: {
+			// Insert between the notes around a random time
+			double end = count ? notes.back()->note().end : 10.0;
+			Note n("new");
+			n.begin = unit(random) * end;
+			n.end = n.begin + 0.05 + 0.3 * unit(random);
+			n.note = n.notePrev = pitch(random);
+			op = Operation::newNote(-1, n, unit(random) < 0.5);
+			break;
+		}
+		case 1:
+			op = Operation(Operation::DEL, id);
+			break;
+		case 2: {
+			// Move within the neighbours (as dragging does), which fixes the note
+			Note const& n = notes[id]->note();
+			double delta = (unit(random) - 0.5) * 0.6;
+			if (id > 0) delta = std::max(delta, notes[id - 1]->note().begin + 0.01 - n.begin);
+			if (id + 1 < count) delta = std::min(delta, notes[id + 1]->note().begin - 0.01 - n.begin);
+			op = Operation::move(id, n.begin + delta, n.end + delta, pitch(random));
+			break;
+		}
+		default:
+			op = Operation(Operation::FLOATING, id, !notes[id]->isFloating());
+		}
+		widget.doOperation(op, Operation::NO_EMIT | Operation::NO_UPDATE);
+		widget.updateNotes(leftToRight);
+		return op.dump();
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	// Widgets are laid out without showing them
+	qputenv("QT_QPA_PLATFORM", "offscreen");
+	QApplication app(argc, argv);
+	app.setApplicationName(PACKAGE);
+
+	unsigned seed = 1;
+	unsigned steps = 20000;
+	QStringList args = app.arguments();
+	for (int i = 1; i < args.size(); ++i) {
+		bool hasValue = i + 1 < args.size();
+		if (args[i] == "--seed" && hasValue) seed = args[++i].toUInt();
+		else if (args[i] == "--steps" && hasValue) steps = args[++i].toUInt();
+		else {
+			bool help = args[i] == "--help" || args[i] == "-h";
+			(help ? std::cout : std::cerr) << "composer-layoutcheck [--seed N] [--steps N]" << std::endl;
+			return help ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	std::mt19937 random(seed);
+	LayoutWidget widget;
+	widget.resize(1280, widget.height());
+	bool leftToRight = true;
+	for (unsigned step = 0; step < steps; ++step) {
+		// Start over now and then so that the song neither grows nor empties
+		if (step % 500 == 0) {
+			widget.doOperation(Operation(Operation::CLEAR), Operation::NO_EMIT);
+			createSong(widget, random);
+		}
+		// Change the direction now and then (the next layout is then a full one)
+		if (random() % 16 == 0) leftToRight = !leftToRight;
+		std::string edit = randomEdit(widget, random, leftToRight);
+		std::vector<NoteState> incremental = snapshot(widget);
+		widget.relayout(leftToRight);
+		std::vector<NoteState> full = snapshot(widget);
+		int diff = difference(incremental, full);
+		if (diff >= 0) {
+			std::cerr << "Step " << step << ": the incremental layout after " << edit << (leftToRight ? "" : " (right to left)")
+			  << " differs from the full layout at note " << diff << std::endl;
+			print(std::cerr, "Incremental", incremental, diff);
+			print(std::cerr, "Full", full, diff);
+			return EXIT_FAILURE;
+		}
+	}
+	std::cout << steps << " incremental layouts identical to the full layout" << std::endl;
+	return EXIT_SUCCESS;
+}
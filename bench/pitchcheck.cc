@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include "config.hh"
+#include "notes.hh"
+#include "pitch.hh"
+#include "pitchpaths.hh"
+#include "signals.hh"
+
+/**
+ * Pitch detection accuracy check.
+ *
+ * composer-pitchcheck [--output FILE]
+ *
+ * Synthesizes signals with known f0 trajectories, runs them through the same
+ * analysis and path extraction as the editor (with each pitch engine at a few
+ * resolutions, including the preview pass of the editor) and compares the
+ * strongest path of each analyzer frame against the truth. Run it before and
+ * after changing an engine to see that the results do not get worse.
+ */
+
+namespace {
+	using Signals::rate;
+
+	struct Case {
+		std::string name;
+		Signals::Trajectory f0;
+		std::vector<float> pcm;
+	};
+
+	/// Engine and resolution to score
+	struct Method {
+		std::string name;
+		PitchEngine::Type engine;
+		AnalyzerConfig config;
+		unsigned decimation;  ///< Analyze every decimation'th sample (the preview pass of the editor)
+	};
+
+	struct Score {
+		std::string name;
+		std::string engine;
+		unsigned frames;  ///< Frames that were scored (voicing changes within the analysis window are skipped)
+		double gross;  ///< Voiced frames more than half a semitone off
+		double octave;  ///< Voiced frames off by whole octaves (part of gross)
+		double fineCents;  ///< Mean absolute error (cents) of the voiced frames that are not gross errors
+		double recall;  ///< Voiced frames detected as voiced
+		double precision;  ///< Frames detected as voiced that are voiced
+		double falseAlarm;  ///< Unvoiced frames detected as voiced
+		double seconds;  ///< Analysis time
+		double realtime;  ///< Seconds of audio analyzed per second
+	};
+
+	const double notVoiced = -std::numeric_limits<double>::infinity();
+
+	/// Ratio that is 1 when there is nothing to count
+	double ratio(unsigned count, unsigned total) { return total ? double(count) / total : 1.0; }
+
+	Score check(Case const& c, Method const& method) {
+		typedef std::chrono::steady_clock Clock;
+		PitchPaths paths;
+		Clock::time_point begin = Clock::now();
+		analyzePitch(c.pcm, rate, 1, paths, method.engine, method.config, method.decimation);
+		double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+		// The strongest fragment of each analyzer frame
+		std::unique_ptr<PitchEngine> analyzer = PitchEngine::create(method.engine, double(rate) / method.decimation, method.config);
+		std::size_t size = analyzer->processSize() * method.decimation;
+		double window = double(size) / rate;
+		double step = double(analyzer->processStep() * method.decimation) / rate;
+		unsigned frames = c.pcm.size() < size ? 0 : (c.pcm.size() - size) / (analyzer->processStep() * method.decimation) + 1;
+		std::vector<double> note(frames, notVoiced), level(frames, notVoiced);
+		for (PitchPaths::const_iterator it = paths.begin(); it != paths.end(); ++it) {
+			for (PitchPaths::Fragments f = paths.fragments(*it); f.valid(); ++f) {
+				unsigned frame = std::lround(f->time / step);
+				if (frame < frames && f->level > level[frame]) { level[frame] = f->level; note[frame] = f->note; }
+			}
+		}
+
+		MusicalScale scale;
+		unsigned scored = 0, voiced = 0, unvoiced = 0, detected = 0, hits = 0, falseAlarms = 0, gross = 0, octave = 0, fine = 0;
+		double fineCents = 0.0;
+		for (unsigned frame = 0; frame < frames; ++frame) {
+			// Only score frames whose whole window is either voiced or unvoiced
+			double t = frame * step;
+			unsigned voicedPoints = 0;
+			const unsigned points = 9;
+			for (unsigned i = 0; i < points; ++i) voicedPoints += c.f0(t + window * i / (points - 1)) > 0.0;
+			if (voicedPoints != 0 && voicedPoints != points) continue;
+			++scored;
+			bool isVoiced = voicedPoints == points;
+			bool isDetected = note[frame] != notVoiced;
+			if (isDetected) ++detected;
+			if (!isVoiced) {
+				++unvoiced;
+				if (isDetected) ++falseAlarms;
+				continue;
+			}
+			++voiced;
+			if (!isDetected) continue;
+			++hits;
+			double cents = 100.0 * (note[frame] - scale.getNote(c.f0(t + 0.5 * window)));
+			if (std::abs(cents) <= 50.0) { fineCents += std::abs(cents); ++fine; continue; }
+			++gross;
+			if (std::abs(cents - 1200.0 * std::round(cents / 1200.0)) <= 50.0) ++octave;
+		}
+
+		double audio = double(c.pcm.size()) / rate;
+		Score s = { c.name, method.name, scored, ratio(gross, hits), ratio(octave, hits), fine ? fineCents / fine : 0.0,
+		  ratio(hits, voiced), ratio(hits, detected), unvoiced ? double(falseAlarms) / unvoiced : 0.0,
+		  seconds, audio / seconds };
+		if (!hits) s.gross = s.octave = 0.0;
+		return s;
+	}
+
+	std::vector<Case> cases() {
+		using namespace Signals;
+		std::vector<Case> ret;
+		auto add = [&ret](std::string const& name, Trajectory const& f0, std::vector<float> const& pcm) {
+			ret.push_back(Case{ name, f0, pcm });
+		};
+		// Fifths over four octaves from the lowest singing notes up, with pauses
+		Trajectory scale = notes(82.41, 7.0, 0.8, 0.3);
+		add("notes", scale, tone(8 * 1.1, scale));
+		add("notes-missing-fundamental", scale, tone(8 * 1.1, scale, 2));
+		add("notes-noise", scale, mix(tone(8 * 1.1, scale), noise(8 * 1.1, 0.05f)));
+		Trajectory up = glide(110.0, 880.0, 6.0);
+		add("glide", up, tone(6.0, up));
+		Trajectory vib = vibrato(330.0);
+		add("vibrato", vib, tone(6.0, vib));
+		Trajectory deep = vibrato(220.0, 1.0, 6.5);
+		add("vibrato-deep", deep, tone(6.0, deep));
+		Trajectory silent = steady(0.0);
+		add("noise", silent, noise(4.0, 0.2f));
+		return ret;
+	}
+
+	void writeJson(std::ostream& os, std::vector<Score> const& scores) {
+		os << "{\n\t\"version\": \"" << VERSION << "\",\n\t\"results\": [";
+		for (std::size_t i = 0; i < scores.size(); ++i) {
+			Score const& s = scores[i];
+			os << (i ? ",\n" : "\n") << "\t\t{ \"name\": \"" << s.name << "\", \"engine\": \"" << s.engine << "\", \"frames\": " << s.frames
+			  << ", \"gross\": " << s.gross << ", \"octave\": " << s.octave << ", \"fineCents\": " << s.fineCents
+			  << ", \"recall\": " << s.recall << ", \"precision\": " << s.precision << ", \"falseAlarm\": " << s.falseAlarm
+			  << ", \"seconds\": " << s.seconds << ", \"realtime\": " << s.realtime << " }";
+		}
+		os << "\n\t]\n}\n";
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	std::string output;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc) output = argv[++i];
+		else {
+			bool help = std::strcmp(argv[i], "--help") == 0 || std::strcmp(argv[i], "-h") == 0;
+			(help ? std::cout : std::cerr) << "composer-pitchcheck [--output FILE]" << std::endl;
+			return help ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	std::vector<Score> scores;
+	std::cerr << "engine               case                        gross  octave  cents  recall  precision  false  realtime" << std::endl;
+	std::vector<Method> methods = {
+		{ "harmonic", PitchEngine::HARMONIC, AnalyzerConfig(), 1 },
+		{ "harmonic-preview", PitchEngine::HARMONIC, AnalyzerConfig::preview(), 1 },
+		{ "harmonic-fine", PitchEngine::HARMONIC, AnalyzerConfig::fine(), 1 },
+		{ "harmonic-progressive", PitchEngine::HARMONIC, previewPass(PitchEngine::HARMONIC).config, previewPass(PitchEngine::HARMONIC).decimation },
+		{ "yin", PitchEngine::YIN, AnalyzerConfig(), 1 },
+		{ "yin-progressive", PitchEngine::YIN, previewPass(PitchEngine::YIN).config, previewPass(PitchEngine::YIN).decimation },
+	};
+	for (Case const& c: cases()) for (Method const& method: methods) {
+		Score s = check(c, method);
+		char line[200];
+		std::snprintf(line, sizeof(line), "%-20s %-26s %5.1f%% %6.1f%% %6.1f %6.1f%% %9.1f%% %5.1f%% %8.1fx",
+		  s.engine.c_str(), s.name.c_str(), 100.0 * s.gross, 100.0 * s.octave, s.fineCents, 100.0 * s.recall, 100.0 * s.precision,
+		  100.0 * s.falseAlarm, s.realtime);
+		std::cerr << line << std::endl;
+		scores.push_back(s);
+	}
+
+	if (output.empty()) writeJson(std::cout, scores);
+	else {
+		std::ofstream os(output.c_str());
+		writeJson(os, scores);
+		if (!os) {
+			std::cerr << "Cannot write " << output << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
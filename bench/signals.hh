@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * @brief Deterministic test signals for the benchmarks and the pitch accuracy check.
+ *
+ * Everything is generated from closed-form trajectories and a fixed-seed
+ * generator, so the same samples come out on every run and platform.
+ */
+namespace Signals {
+	const unsigned rate = 48000;
+
+	/// Fundamental frequency (Hz) at time t (seconds), zero where unvoiced
+	typedef std::function<double (double t)> Trajectory;
+
+	/// Harmonic tone following f0 (harmonics firstHarmonic..8 with 1/h amplitudes), faded in and out at voicing changes
+	inline std::vector<float> tone(double seconds, Trajectory const& f0, unsigned firstHarmonic = 1) {
+		std::vector<float> pcm(seconds * rate);
+		const double fade = 1.0 - std::exp(-1.0 / (0.005 * rate));  // 5 ms time constant
+		double phase = 0.0, gain = 0.0, freq = 0.0;
+		for (std::size_t i = 0; i < pcm.size(); ++i) {
+			double f = f0(double(i) / rate);
+			if (f > 0.0) freq = f;  // Keep the last pitch while fading out
+			gain += ((f > 0.0 ? 1.0 : 0.0) - gain) * fade;
+			phase += 2.0 * M_PI * freq / rate;
+			double s = 0.0;
+			for (unsigned h = firstHarmonic; h <= 8; ++h) s += std::sin(h * phase) / h;
+			pcm[i] = 0.2 * gain * s;
+		}
+		return pcm;
+	}
+
+	/// White noise from a linear congruential generator
+	inline std::vector<float> noise(double seconds, float amplitude = 0.5f, std::uint32_t seed = 12345) {
+		std::vector<float> pcm(seconds * rate);
+		for (float& s: pcm) {
+			seed = seed * 1664525u + 1013904223u;
+			s = amplitude * (float(seed) / 4294967296.0f * 2.0f - 1.0f);
+		}
+		return pcm;
+	}
+
+	/// Add other onto pcm (both of the same length)
+	inline std::vector<float> mix(std::vector<float> pcm, std::vector<float> const& other) {
+		for (std::size_t i = 0; i < pcm.size() && i < other.size(); ++i) pcm[i] += other[i];
+		return pcm;
+	}
+
+	/// Constant pitch
+	inline Trajectory steady(double freq) { return [freq](double) { return freq; }; }
+	/// Exponential glide from f1 to f2 over seconds
+	inline Trajectory glide(double f1, double f2, double seconds) {
+		return [f1, f2, seconds](double t) { return f1 * std::pow(f2 / f1, std::min(t / seconds, 1.0)); };
+	}
+	/// Vibrato of depth semitones (peak) at rate Hz around freq
+	inline Trajectory vibrato(double freq, double depth = 0.5, double speed = 5.5) {
+		return [freq, depth, speed](double t) { return freq * std::pow(2.0, depth / 12.0 * std::sin(2.0 * M_PI * speed * t)); };
+	}
+	/// Notes of length seconds separated by gap seconds of silence, each interval semitones higher, starting at freq
+	inline Trajectory notes(double freq, double interval, double length, double gap) {
+		return [freq, interval, length, gap](double t) {
+			double period = length + gap;
+			double n = std::floor(t / period);
+			if (t - n * period >= length) return 0.0;
+			return freq * std::pow(2.0, n * interval / 12.0);
+		};
+	}
+}
@@ -0,0 +1,246 @@
+#include <QAudioOutput>
+#include <QAudioDeviceInfo>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include "audioplayer.hh"
+#include "ffmpeg.hh"
+#include "util.hh"
+
+namespace {
+	const int channels = 2; // FFmpeg always outputs stereo (mapped to the device channels when rendering)
+	const int bufferMs = 50; // Audio device buffer
+	const int updateMs = 15; // Interval of positionChanged() while playing
+}
+
+AudioPlayer::AudioPlayer(QObject *parent)
+	: QIODevice(parent), m_output(), m_state(StoppedState), m_rate(1.0), m_volume(100),
+	m_sourceTime(), m_rendered(), m_ended(),
+	m_clockSeq(), m_clockFrame(), m_clockTime(), m_clockRate(1.0), m_lastTime()
+{
+	QAudioFormat format;
+	format.setChannelCount(channels);
+	format.setSampleRate(48000);
+	format.setSampleSize(16);
+	format.setSampleType(QAudioFormat::SignedInt);
+	format.setByteOrder(QAudioFormat::LittleEndian);
+	format.setCodec("audio/pcm");
+	// Use what the device can do instead (FFmpeg resamples to its rate)
+	QAudioDeviceInfo device = QAudioDeviceInfo::defaultOutputDevice();
+	if (!device.isFormatSupported(format)) format = device.nearestFormat(format);
+	bool sampleOk = (format.sampleType() == QAudioFormat::SignedInt && format.sampleSize() == 16)
+	  || (format.sampleType() == QAudioFormat::Float && format.sampleSize() == 32);
+	if (!sampleOk || format.byteOrder() != QAudioFormat::LittleEndian || format.channelCount() < 1 || format.sampleRate() <= 0)
+		m_formatError = tr("The audio device does not support 16 bit or float PCM output");
+	m_output = new QAudioOutput(format, this);
+	m_output->setBufferSize(format.bytesForDuration(bufferMs * 1000));
+
+	open(QIODevice::ReadOnly);
+	m_timer.setInterval(updateMs);
+	connect(&m_timer, SIGNAL(timeout()), this, SLOT(tick()));
+}
+
+AudioPlayer::~AudioPlayer()
+{
+	m_output->stop();
+}
+
+void AudioPlayer::setFile(const QString &fileName)
+{
+	m_output->stop();
+	m_timer.stop();
+	m_ffmpeg.reset();
+	m_stretch.reset();
+	m_sourceTime = 0.0;
+	m_ended = false;
+	m_fileName = fileName;
+	m_lastTime = 0.0;
+	publishClock(0.0);
+	setState(StoppedState);
+	if (fileName.isEmpty()) return;
+	if (!m_formatError.isEmpty()) {
+		m_errorString = m_formatError;
+		emit error();
+		return;
+	}
+
+	try {
+		std::string file(fileName.toLocal8Bit().data(), fileName.toLocal8Bit().size());
+		m_ffmpeg.reset(new FFmpeg(file, m_output->format().sampleRate()));
+	} catch (std::exception &e) {
+		m_errorString = e.what();
+		emit error();
+		return;
+	}
+	emit metaDataChanged();
+	emit positionChanged(0);
+}
+
+QString AudioPlayer::metaData(const QString &key) const
+{
+	if (!m_ffmpeg) return QString();
+	std::map<std::string, std::string> const& tags = m_ffmpeg->metadata();
+	std::map<std::string, std::string>::const_iterator it = tags.find(key.toLower().toStdString());
+	return it == tags.end() ? QString() : QString::fromUtf8(it->second.c_str());
+}
+
+double AudioPlayer::currentTime() const
+{
+	// Read the published clock without locking (retry if it was being written)
+	qint64 frame;
+	double time, rate;
+	unsigned seq;
+	do {
+		seq = m_clockSeq.load(std::memory_order_acquire);
+		frame = m_clockFrame.load(std::memory_order_relaxed);
+		time = m_clockTime.load(std::memory_order_relaxed);
+		rate = m_clockRate.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((seq & 1) || seq != m_clockSeq.load(std::memory_order_relaxed));
+
+	if (m_output->state() == QAudio::StoppedState) return time;
+	// The frame being played is behind the rendered ones by what is buffered
+	double played = m_output->processedUSecs() * 1e-6 * m_output->format().sampleRate();
+	double t = time + (played - frame) / m_output->format().sampleRate() * rate;
+	// Block boundaries may round a little backwards
+	if (t < m_lastTime && t > m_lastTime - 0.001 * bufferMs) t = m_lastTime;
+	m_lastTime = t;
+	return t;
+}
+
+double AudioPlayer::sourceTime() const
+{
+	// The stretcher starts a little before its first frame at slow rates
+	return m_sourceTime + std::max(m_stretch.position(), 0.0) / m_output->format().sampleRate();
+}
+
+void AudioPlayer::publishClock(double time)
+{
+	unsigned seq = m_clockSeq.load(std::memory_order_relaxed);
+	m_clockSeq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	m_clockFrame.store(m_rendered, std::memory_order_relaxed);
+	m_clockTime.store(time, std::memory_order_relaxed);
+	m_clockRate.store(m_rate, std::memory_order_relaxed);
+	m_clockSeq.store(seq + 2, std::memory_order_release);
+}
+
+qint64 AudioPlayer::bytesAvailable() const
+{
+	// Endless stream (silence after the end) while a file is open
+	return (m_ffmpeg ? m_output->bufferSize() : 0) + QIODevice::bytesAvailable();
+}
+
+qint64 AudioPlayer::readData(char *data, qint64 maxSize)
+{
+	QAudioFormat format = m_output->format();
+	const qint64 frames = maxSize / format.bytesPerFrame();
+	publishClock(sourceTime());
+
+	// Get what the decoder has ready (never wait here, the device is waiting for us)
+	if (m_ffmpeg && m_stretch.buffered() < frames * m_rate + TimeStretch::lookahead) {
+		m_pcm.clear();
+		if (!m_ffmpeg->audioQueue.output(m_pcm, false)) m_stretch.finish();
+		m_stretch.input(m_pcm);
+	}
+
+	std::vector<da::sample_t> pcm(frames * channels, 0.0f); // Silence if the decoder is behind
+	m_stretch.output(pcm.data(), frames, m_rate);
+	// Stereo to the device channels: mono gets the average, extra channels are silent
+	int outChannels = format.channelCount();
+	std::vector<float> out(frames * outChannels, 0.0f);
+	for (qint64 i = 0; i < frames; ++i) {
+		float const* in = &pcm[i * channels];
+		float* o = &out[i * outChannels];
+		if (outChannels == 1) o[0] = 0.5f * (in[0] + in[1]);
+		else std::copy(in, in + channels, o);
+	}
+	if (format.sampleType() == QAudioFormat::Float) std::memcpy(data, out.data(), out.size() * sizeof(float));
+	else {
+		std::vector<qint16> s16(out.size());
+		for (std::size_t i = 0; i < s16.size(); ++i) s16[i] = clamp(out[i], -1.0f, 32767.0f / 32768.0f) * 32768;
+		std::memcpy(data, s16.data(), s16.size() * sizeof(qint16));
+	}
+	if (m_stretch.done() && !m_ended) {
+		m_ended = true;
+		QMetaObject::invokeMethod(this, "finished", Qt::QueuedConnection);
+	}
+	m_rendered += frames;
+	return frames * format.bytesPerFrame();
+}
+
+void AudioPlayer::play()
+{
+	if (!m_ffmpeg) return;
+	if (m_output->state() == QAudio::SuspendedState) m_output->resume();
+	else if (m_output->state() == QAudio::StoppedState) {
+		if (m_ended) setPosition(0);
+		// The device counts from zero again
+		m_rendered = 0;
+		publishClock(sourceTime());
+		m_output->start(this); // Pull mode: the device calls readData as it needs audio
+	}
+	m_timer.start();
+	setState(PlayingState);
+}
+
+void AudioPlayer::pause()
+{
+	if (m_state != PlayingState) return;
+	m_output->suspend();
+	m_timer.stop();
+	setState(PausedState);
+	emit positionChanged(position());
+}
+
+void AudioPlayer::finished()
+{
+	double end = sourceTime();
+	m_output->stop();
+	m_timer.stop();
+	publishClock(end);
+	setState(StoppedState);
+	emit positionChanged(position());
+}
+
+void AudioPlayer::setPosition(qint64 position)
+{
+	if (!m_ffmpeg) return;
+	double time = std::max<qint64>(position, 0) / 1000.0;
+	m_ffmpeg->seek(time); // The decoder starts exactly at time
+	m_stretch.reset();
+	m_sourceTime = time;
+	m_ended = false;
+	m_lastTime = time;
+	// While playing, the audio already buffered is still heard before the new position
+	if (m_output->state() != QAudio::ActiveState && m_output->state() != QAudio::IdleState)
+		m_rendered = m_output->processedUSecs() * 1e-6 * m_output->format().sampleRate();
+	publishClock(time);
+	emit positionChanged(this->position());
+}
+
+void AudioPlayer::setPlaybackRate(qreal rate)
+{
+	if (rate <= 0.0 || rate == m_rate) return;
+	m_rate = rate;
+	emit playbackRateChanged(rate);
+}
+
+void AudioPlayer::setVolume(int volume)
+{
+	m_volume = clamp(volume, 0, 100);
+	m_output->setVolume(m_volume / 100.0);
+}
+
+void AudioPlayer::tick()
+{
+	emit positionChanged(position());
+}
+
+void AudioPlayer::setState(State state)
+{
+	if (state == m_state) return;
+	m_state = state;
+	emit stateChanged(state);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <QIODevice>
+#include <QScopedPointer>
+#include <QString>
+#include <QTimer>
+#include <atomic>
+#include <cmath>
+#include <vector>
+#include "libda/sample.hpp"
+#include "timestretch.hh"
+
+class QAudioOutput;
+class FFmpeg;
+
+/**
+ * @brief Music playback through our own decoder with a sample-accurate clock.
+ *
+ * The FFmpeg decoder feeds a single QAudioOutput in pull mode (AudioPlayer is the
+ * QIODevice it reads), decoding at the rate of the device. Each rendered block publishes the song position of its
+ * first frame, so the position of the frame the device is playing is known to
+ * the sample instead of being extrapolated from periodic notifications.
+ *
+ * The playback rate is applied by TimeStretch, so the pitch is kept and the
+ * clock still reports song time.
+ *
+ * The interface follows the parts of QMediaPlayer the editor used.
+ */
+class AudioPlayer: public QIODevice
+{
+	Q_OBJECT
+public:
+	enum State { StoppedState, PlayingState, PausedState };
+
+	AudioPlayer(QObject *parent = NULL);
+	~AudioPlayer();
+
+	/// Open a music file (an empty name closes the current one)
+	void setFile(const QString &fileName);
+	QString fileName() const { return m_fileName; }
+	State state() const { return m_state; }
+	/// Playback position in milliseconds
+	qint64 position() const { return std::llround(currentTime() * 1000.0); }
+	/// Playback position in seconds, as heard (never goes backwards while playing)
+	double currentTime() const;
+	qreal playbackRate() const { return m_rate; }
+	/// Tag of the file (FFmpeg key such as "title", "album_artist", "genre", "date"), empty if not found
+	QString metaData(const QString &key) const;
+	QString errorString() const { return m_errorString; }
+
+	bool isSequential() const { return true; }
+	qint64 bytesAvailable() const;
+
+public slots:
+	void play();
+	void pause();
+	/// Seek (milliseconds)
+	void setPosition(qint64 position);
+	/// Playback speed multiplier
+	void setPlaybackRate(qreal rate);
+	/// Volume in percent
+	void setVolume(int volume);
+
+signals:
+	void positionChanged(qint64 position);
+	void stateChanged(AudioPlayer::State state);
+	void playbackRateChanged(qreal rate);
+	void metaDataChanged();
+	void error();
+
+protected:
+	qint64 readData(char *data, qint64 maxSize);
+	qint64 writeData(const char*, qint64) { return -1; }
+
+private slots:
+	void tick();
+	void finished();
+
+private:
+	/// Position of the first frame of the next rendered block (published for currentTime())
+	void publishClock(double time);
+	/// Song time of the next frame to render
+	double sourceTime() const;
+	void setState(State state);
+
+	QScopedPointer<FFmpeg> m_ffmpeg;
+	QAudioOutput *m_output;
+	QTimer m_timer; ///< Position updates while playing
+	QString m_fileName;
+	QString m_errorString;
+	QString m_formatError; ///< Why the output device cannot be used (empty if it can)
+	State m_state;
+	double m_rate; ///< Playback speed multiplier
+	int m_volume;
+
+	// Rendering state (only touched by readData and while the output is stopped)
+	std::vector<da::sample_t> m_pcm; ///< Decoded samples being passed to m_stretch
+	TimeStretch m_stretch; ///< Applies the playback rate without changing pitch
+	double m_sourceTime; ///< Song time where m_stretch was reset
+	qint64 m_rendered; ///< Frames rendered to the device since start
+	bool m_ended;
+
+	// Clock published by readData: song time m_clockTime at rendered frame m_clockFrame, advancing by m_clockRate
+	std::atomic<unsigned> m_clockSeq; ///< Odd while being written
+	std::atomic<qint64> m_clockFrame;
+	std::atomic<double> m_clockTime;
+	std::atomic<double> m_clockRate;
+	mutable double m_lastTime; ///< For keeping the reported position monotonic
+};
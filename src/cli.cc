@@ -0,0 +1,192 @@
+#include "cli.hh"
+#include "pitchpaths.hh"
+#include "songparser.hh"
+#include "songwriter.hh"
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+	struct Options {
+		QString command;
+		QString format; ///< analyze: json or binary, convert: the target format
+		QString outDir; ///< Empty = next to each input file
+		unsigned jobs;
+		PitchEngine::Type engine;  ///< analyze: the pitch detection method
+		AnalyzerConfig resolution;  ///< analyze: time and frequency resolution
+		QStringList files;
+	};
+
+	std::mutex outputMutex; ///< Keeps the report lines of the workers whole
+
+	void report(bool ok, QString const& file, std::string const& message) {
+		std::lock_guard<std::mutex> lock(outputMutex);
+		(ok ? std::cout : std::cerr) << (ok ? "OK   " : "FAIL ") << file.toStdString()
+			<< (message.empty() ? "" : ": ") << message << std::endl;
+	}
+
+	/// Add the song files within dir (recursively)
+	void findSongs(QString const& dir, QStringList& files) {
+		QDirIterator it(dir, QStringList() << "notes.txt" << "notes.xml" << "song.ini", QDir::Files, QDirIterator::Subdirectories);
+		while (it.hasNext()) files << it.next();
+	}
+
+	/// Call job(0..count-1) from jobs threads, returns the number of jobs that failed
+	unsigned parallel(int count, unsigned jobs, std::function<bool (int)> const& job) {
+		std::atomic<int> next(0);
+		std::atomic<unsigned> failures(0);
+		auto worker = [&]() {
+			for (int i; (i = next++) < count; ) if (!job(i)) ++failures;
+		};
+		std::vector<std::thread> threads;
+		for (unsigned t = 1; t < jobs; ++t) threads.push_back(std::thread(worker));
+		worker();
+		for (std::thread& t: threads) t.join();
+		return failures;
+	}
+
+	/// Where to write the output for input: the output folder/the name of the input's folder, or the input's folder
+	QString outputDir(Options const& opt, QFileInfo const& input) {
+		if (opt.outDir.isEmpty()) return input.absolutePath();
+		return opt.outDir + "/" + input.absoluteDir().dirName();
+	}
+
+	/// Parse a song file, throws on errors
+	std::unique_ptr<Song> loadSong(QString const& file) {
+		QFileInfo finfo(file);
+		return std::unique_ptr<Song>(new Song(finfo.absolutePath() + "/", finfo.fileName()));
+	}
+
+	bool validate(Options const&, QString const& file) {
+		std::unique_ptr<Song> song = loadSong(file);
+		report(true, file, std::to_string(song->getVocalTrack().notes.size()) + " notes");
+		return true;
+	}
+
+	bool convert(Options const& opt, QString const& file) {
+		std::unique_ptr<Song> song = loadSong(file);
+		QString dir = outputDir(opt, QFileInfo(file));
+		if (opt.format == "xml") SingStarXMLWriter(*song, dir);
+		else if (opt.format == "txt") UltraStarTXTWriter(*song, dir);
+		else if (opt.format == "ini") FoFMIDIWriter(*song, dir);
+		else if (opt.format == "lrc") LRCWriter(*song, dir, false);
+		else if (opt.format == "elrc") LRCWriter(*song, dir, true);
+		else if (opt.format == "smm") SMMWriter(*song, dir);
+		report(true, file, dir.toStdString());
+		return true;
+	}
+
+	bool analyze(Options const& opt, QString const& file) {
+		QFileInfo finfo(file);
+		PitchPaths paths;
+		analyzePitch(file.toLocal8Bit().data(), paths, opt.engine, opt.resolution);
+		QString dir = outputDir(opt, finfo);
+		QDir().mkpath(dir);
+		bool json = opt.format == "json";
+		QString out = dir + "/" + finfo.completeBaseName() + (json ? ".pitch.json" : ".pitch");
+		std::ofstream os(out.toLocal8Bit().data(), std::ios::binary);
+		if (json) paths.writeJson(os);
+		else paths.write(os);
+		if (!os) throw std::runtime_error("Cannot write " + out.toStdString());
+		report(true, file, std::to_string(paths.size()) + " paths to " + out.toStdString());
+		return true;
+	}
+}
+
+bool Cli::isCommand(QString const& arg)
+{
+	return arg == "analyze" || arg == "convert" || arg == "validate";
+}
+
+char const* Cli::usage()
+{
+	return
+		"analyze [options] MUSIC...    dump the pitch paths of music files (next to them by default)\n"
+		"  -f [ --format ] json|binary   output format (default json)\n"
+		"  -e [ --engine ] harmonic|yin  pitch detection for mixed music (default) or isolated vocals\n"
+		"  -r [ --resolution ] preview|normal|fine   coarse and fast, default or dense and slow\n"
+		"convert -f FORMAT [options] SONG...    write songs in another format\n"
+		"  -f [ --format ] xml|txt|ini|lrc|elrc|smm   SingStar XML, UltraStar TXT, Frets on Fire MIDI,\n"
+		"                                   LRC, enhanced LRC or Soramimi TXT\n"
+		"validate [options] SONG...    check that songs parse\n"
+		"common options:\n"
+		"  -o [ --output ] DIR   write into DIR/<folder of the input> instead\n"
+		"  -j [ --jobs ] N       number of worker threads (default: all cores)\n"
+		"a folder given as SONG is searched for notes.txt, notes.xml and song.ini files,\n"
+		"- reads the file names from standard input, one per line\n";
+}
+
+int Cli::run(QStringList const& args)
+{
+	Options opt;
+	opt.command = args.value(1);
+	opt.jobs = std::max(1u, std::thread::hardware_concurrency());
+	opt.engine = PitchEngine::HARMONIC;
+	if (opt.command == "analyze") opt.format = "json";
+	for (int i = 2; i < args.size(); ++i) {
+		QString const& arg = args[i];
+		bool hasValue = i + 1 < args.size();
+		if ((arg == "-o" || arg == "--output") && hasValue) opt.outDir = args[++i];
+		else if ((arg == "-j" || arg == "--jobs") && hasValue) opt.jobs = std::max(1, args[++i].toInt());
+		else if ((arg == "-f" || arg == "--format") && hasValue) opt.format = args[++i].toLower();
+		else if ((arg == "-e" || arg == "--engine") && hasValue) {
+			try {
+				opt.engine = PitchEngine::type(args[++i].toLower().toStdString());
+			} catch (std::invalid_argument& e) {
+				std::cerr << e.what() << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if ((arg == "-r" || arg == "--resolution") && hasValue) {
+			QString res = args[++i].toLower();
+			if (res == "preview") opt.resolution = AnalyzerConfig::preview();
+			else if (res == "fine") opt.resolution = AnalyzerConfig::fine();
+			else if (res != "normal") {
+				std::cerr << "Unknown resolution: " << res.toStdString() << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (arg == "-") {
+			for (std::string line; std::getline(std::cin, line); )
+				if (!line.empty()) opt.files << QString::fromLocal8Bit(line.c_str());
+		}
+		else if (arg.startsWith("-")) {
+			std::cerr << "Unknown option: " << arg.toStdString() << std::endl;
+			return EXIT_FAILURE;
+		}
+		else if (opt.command != "analyze" && QFileInfo(arg).isDir()) findSongs(arg, opt.files);
+		else opt.files << arg;
+	}
+
+	std::function<bool (Options const&, QString const&)> job;
+	QStringList formats;
+	if (opt.command == "analyze") { job = analyze; formats << "json" << "binary"; }
+	else if (opt.command == "convert") { job = convert; formats << "xml" << "txt" << "ini" << "lrc" << "elrc" << "smm"; }
+	else if (opt.command == "validate") job = validate;
+	if (!job || opt.files.isEmpty() || (!formats.isEmpty() && !formats.contains(opt.format))) {
+		std::cerr << usage();
+		return EXIT_FAILURE;
+	}
+
+	unsigned failures = parallel(opt.files.size(), opt.jobs, [&](int i) {
+		try {
+			return job(opt, opt.files[i]);
+		} catch (std::exception& e) {
+			report(false, opt.files[i], e.what());
+			return false;
+		}
+	});
+	std::cerr << opt.files.size() - failures << " of " << opt.files.size() << " files done" << std::endl;
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
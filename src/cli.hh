@@ -0,0 +1,18 @@
+#pragma once
+
+#include <QStringList>
+
+/**
+ * @brief Command line batch mode (no display needed).
+ *
+ * composer analyze|convert|validate [options] files...
+ * Songs and music files are processed by a pool of worker threads.
+ */
+namespace Cli {
+	/// Is arg (the first argument) a batch command?
+	bool isCommand(QString const& arg);
+	/// Run the command given by args[1] (args[0] is the program), returns the exit code
+	int run(QStringList const& args);
+	/// Usage of the batch commands (for --help)
+	char const* usage();
+}
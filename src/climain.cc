@@ -0,0 +1,19 @@
+#include <QCoreApplication>
+#include <cstdlib>
+#include <iostream>
+#include "config.hh"
+#include "cli.hh"
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	app.setApplicationName(PACKAGE);
+	app.setApplicationVersion(VERSION);
+
+	QStringList args = QCoreApplication::arguments();
+	if (args.size() < 2 || !Cli::isCommand(args[1])) {
+		std::cout << PACKAGE << " " << VERSION << " batch mode" << std::endl << std::endl << Cli::usage();
+		return args.size() < 2 || args[1] == "--help" || args[1] == "-h" ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	return Cli::run(args);
+}
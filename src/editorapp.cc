@@ -1,5 +1,6 @@
 #include <QProgressBar>
 #include <QPushButton>
+#include <QGridLayout>
 #include <QScrollBar>
 #include <QMessageBox>
 #include <QFileDialog>
@@ -12,7 +13,6 @@
 #include <QPainter>
 #include <QSettings>
 #include <QTimer>
-#include <QMediaPlayer>
 #include <iostream>
 #include "config.hh"
 #include "editorapp.hh"
@@ -22,11 +22,13 @@
 #include "textcodecselector.hh"
 #include "gettingstarted.hh"
 #include "busydialog.hh"
+#include "guidetrack.hh"
 
 namespace {
 	static const QString PROJECT_SAVE_FILE_EXTENSION = "songproject"; // FIXME: Nice extension here
 	static const quint32 PROJECT_SAVE_FILE_MAGIC = 0x50455350;
-	static const quint32 PROJECT_SAVE_FILE_VERSION = 101; // File format version 1.01
+	static const quint32 PROJECT_SAVE_FILE_VERSION = 102; // File format version 1.02
+	static const quint32 PROJECT_SAVE_FILE_VERSION_VARIANT_OPS = 101; // Operations stored as QVariant lists
 	static const QDataStream::Version PROJECT_SAVE_FILE_STREAM_VERSION = QDataStream::Qt_4_7;
 
 	// Helper function scans widget's children and sets their status tips to their tooltips
@@ -44,10 +46,11 @@ namespace {
 
 EditorApp::EditorApp(QWidget *parent)
 	: QMainWindow(parent), gettingStarted(), noteGraph(), player(), synth(), statusbarProgress(),
-	projectFileName(), latestPath(QDir::homePath()), currentBufferPlayer()
+	projectFileName(), latestPath(QDir::homePath())
 {
 	ui.setupUi(this);
 	readSettings();
+	SongParser::codecSelector = [](QByteArray const& ba) { return TextCodecSelector::codecForContent(ba); };
 
 	ui.helpDock->setVisible(false);
 
@@ -118,7 +121,9 @@ EditorApp::EditorApp(QWidget *parent)
 			}
 		}, Qt::Orientation::Horizontal);
 	
-	ui.noteGraphScroller->setHorizontalScrollBar(m_scrollBar);
+	// The note graph is only as wide as the view and scrolls horizontally by itself (see NoteLabelManager::setViewBegin)
+	ui.noteGraphScroller->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+	ui.noteGraphScroller->setWidgetResizable(true);
 	
 	// Statusbar stuff
 	statusbarButton = new QPushButton(NULL);
@@ -133,10 +138,7 @@ EditorApp::EditorApp(QWidget *parent)
 	updateMenuStates();
 
 	// Audio stuff
-	player = new QMediaPlayer(this);
-	player->setNotifyInterval(100);
-	bufferPlayers[0] = new BufferPlayer(this);
-	bufferPlayers[1] = new BufferPlayer(this);
+	player = new AudioPlayer(this);
 
 	// Audio info
 	QAudioDeviceInfo info(QAudioDeviceInfo::defaultOutputDevice());
@@ -163,17 +165,18 @@ EditorApp::EditorApp(QWidget *parent)
 
 	// Audio signals
 	connect(player, SIGNAL(positionChanged(qint64)), this, SLOT(audioTick(qint64)));
-	connect(player, SIGNAL(stateChanged(QMediaPlayer::State)), this, SLOT(playerStateChanged(QMediaPlayer::State)));
-	connect(player, SIGNAL(error(QMediaPlayer::Error)), this, SLOT(playerError(QMediaPlayer::Error)));
+	connect(player, SIGNAL(stateChanged(AudioPlayer::State)), this, SLOT(playerStateChanged(AudioPlayer::State)));
+	connect(player, SIGNAL(error()), this, SLOT(playerError()));
 	connect(player, SIGNAL(metaDataChanged()), this, SLOT(metaDataChanged()));
 	connect(player, SIGNAL(playbackRateChanged(qreal)), this, SLOT(playbackRateChanged(qreal)));
 
 	// The piano keys
 	piano = new Piano(ui.topFrame);
-	QHBoxLayout *hl = new QHBoxLayout(ui.topFrame);
-	hl->addWidget(piano);
-	hl->addWidget(ui.noteGraphScroller);
-	ui.topFrame->setLayout(hl);
+	QGridLayout *gl = new QGridLayout(ui.topFrame);
+	gl->addWidget(piano, 0, 0);
+	gl->addWidget(ui.noteGraphScroller, 0, 1);
+	gl->addWidget(m_scrollBar, 1, 1);
+	ui.topFrame->setLayout(gl);
 	connect(ui.noteGraphScroller->verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(updatePiano(int)));
 
 	// NoteGraph setup down here so that the objects we setup signals are already created
@@ -200,6 +203,7 @@ void EditorApp::setupNoteGraph()
 {
 	noteGraph = new NoteGraphWidget(NULL);
 	ui.noteGraphScroller->setWidget(noteGraph); // Deletes previous widget
+	noteGraph->setHorizontalScrollBar(m_scrollBar);
 
 	// Splitter sizes cannot be set through designer :(
 	//QList<int> ss; ss.push_back(700); ss.push_back(300); // Proportions, not pixels
@@ -207,17 +211,17 @@ void EditorApp::setupNoteGraph()
 
 	// Signals/slots
 	connect(noteGraph, SIGNAL(operationDone(const Operation&)), this, SLOT(operationDone(const Operation&)));
+	connect(noteGraph, SIGNAL(operationsDone(const QList<Operation>&)), this, SLOT(operationsDone(const QList<Operation>&)));
 	connect(noteGraph, SIGNAL(updateNoteInfo(NoteLabel*)), this, SLOT(updateNoteInfo(NoteLabel*)));
 	connect(noteGraph, SIGNAL(statusBarMessage(QString)), this, SLOT(statusBarMessage(QString)));
 	connect(noteGraph, SIGNAL(updatedNotes()), this, SLOT(updatedNotes()));
 	connect(statusbarButton, SIGNAL(clicked()), noteGraph, SLOT(abortPitch()));
-	connect(ui.noteGraphScroller->horizontalScrollBar(), SIGNAL(valueChanged(int)), noteGraph, SLOT(updatePitch()));
 	connect(ui.noteGraphScroller->verticalScrollBar(), SIGNAL(valueChanged(int)), noteGraph, SLOT(updatePitch()));
 	connect(ui.actionCut, SIGNAL(triggered()), noteGraph, SLOT(cut()));
 	connect(ui.actionCopy, SIGNAL(triggered()), noteGraph, SLOT(copy()));
 	connect(ui.actionPaste, SIGNAL(triggered()), noteGraph, SLOT(paste()));
-	connect(ui.cmdTimeSentence, SIGNAL(pressed()), noteGraph, SLOT(timeSentence()));
-	connect(ui.cmdTimeNote,SIGNAL(pressed()),noteGraph, SLOT(timeSyllable()));
+	connect(ui.cmdTimeSentence, SIGNAL(pressed()), this, SLOT(timeSentence()));
+	connect(ui.cmdTimeNote, SIGNAL(pressed()), this, SLOT(timeSyllable()));
 	connect(ui.cmdSkipSentence, SIGNAL(pressed()), noteGraph, SLOT(selectNextSentenceStart()));
 	connect(ui.chkGrabSeekHandle, SIGNAL(toggled(bool)), noteGraph, SLOT(setSeekHandleWrapToViewport(bool)));
 	noteGraph->setSeekHandleWrapToViewport(ui.chkGrabSeekHandle->isChecked());
@@ -237,6 +241,17 @@ void EditorApp::operationDone(const Operation &op)
 	opStack.push(op);
 	updateMenuStates();
 	redoStack.clear();
+	updateSynthNotes();
+}
+
+void EditorApp::operationsDone(const QList<Operation> &ops)
+{
+	setWindowModified(true);
+	foreach (const Operation &op, ops)
+		opStack.push(op);
+	updateMenuStates();
+	redoStack.clear();
+	updateSynthNotes();
 }
 
 void EditorApp::statusBarMessage(const QString& message)
@@ -257,11 +272,11 @@ void EditorApp::doOpStack()
 		busy();
 		bool erased = false;
 		try {
-			if (opit->op() == "META") {
+			if (opit->type == Operation::META) {
 				// META ops are handled differently:
 				// They are run once and then removed from the stack.
 				// They are written to disk when saving though.
-				QString metakey = opit->s(1), metavalue = opit->s(2);
+				QString metakey = opit->metaKey(), metavalue = opit->metaValue();
 				opit = opStack.erase(opit);
 				erased = true;
 				if (metakey == "MUSICFILE") {
@@ -294,13 +309,13 @@ void EditorApp::doOpStack()
 	}
 
 	noteGraph->updateNotes();
-	noteGraph->startNotePixmapUpdates();
 	if (!newMusic.isEmpty()) setMusic(newMusic);
 	
 	setVideo(song->video);
 	setBPM(song->bpm);
 	
 	updateMenuStates();
+	updateSynthNotes();
 }
 
 void EditorApp::updateMenuStates()
@@ -308,7 +323,7 @@ void EditorApp::updateMenuStates()
 	// File menu
 	ui.actionSave->setEnabled(isWindowModified());
 	// Edit menu
-	ui.actionUndo->setEnabled(!opStack.isEmpty() && opStack.top().op() != "BLOCK");
+	ui.actionUndo->setEnabled(!opStack.isEmpty() && opStack.top().type != Operation::BLOCK);
 	ui.actionRedo->setEnabled(!redoStack.isEmpty());
 	bool hasSelectedNotes = (noteGraph && noteGraph->selectedNote());
 	ui.actionCut->setEnabled(hasSelectedNotes);
@@ -338,7 +353,7 @@ void EditorApp::updateTitle()
 
 void EditorApp::updateNoteInfo(NoteLabel *note)
 {
-	if (!note || !noteGraph || noteGraph->selectedNotes().size() > 1) {
+	if (!note || !noteGraph || noteGraph->selectedCount() > 1) {
 		ui.cmdSplit->setEnabled(false);
 		ui.cmdInsert->setEnabled(false);
 		ui.lblCurrentSentence->setText(tr("Current phrase:") + " -");
@@ -350,7 +365,7 @@ void EditorApp::updateNoteInfo(NoteLabel *note)
 		}
 	}
 	if (note && noteGraph) {
-		if (noteGraph->selectedNotes().size() == 1) {
+		if (noteGraph->selectedCount() == 1) {
 			// These are only available for single note selections
 			ui.cmdSplit->setEnabled(true);
 			ui.cmdInsert->setEnabled(true);
@@ -403,7 +418,7 @@ void EditorApp::analyzeProgress(int value, int maximum)
 void EditorApp::on_actionNew_triggered()
 {
 	if (promptSaving()) {
-		player->setMedia(NULL);
+		player->setFile("");
 		song.reset(new Song);
 		setupNoteGraph();
 		projectFileName = "";
@@ -453,11 +468,21 @@ void EditorApp::openFile(QString fileName)
 					quint32 magic; in >> magic;
 					if (magic == PROJECT_SAVE_FILE_MAGIC) {
 						quint32 version; in >> version;
-						if (version == PROJECT_SAVE_FILE_VERSION) {
+						if (version == PROJECT_SAVE_FILE_VERSION || version == PROJECT_SAVE_FILE_VERSION_VARIANT_OPS) {
 							in.setVersion(PROJECT_SAVE_FILE_STREAM_VERSION);
 							while (!in.atEnd()) {
 								Operation op;
-								in >> op;
+								if (version == PROJECT_SAVE_FILE_VERSION_VARIANT_OPS) {
+									QList<QVariant> params;
+									in >> params;
+									try {
+										op = Operation::fromVariants(params);
+									} catch (std::runtime_error& e) {
+										std::cerr << "Skipping operation: " << e.what() << std::endl;
+										continue;
+									}
+								} else in >> op;
+								if (in.status() != QDataStream::Ok) throw std::runtime_error("Corrupted project file");
 								//std::cout << "Loaded op: " << op.dump() << std::endl;
 								opStack.push(op);
 							}
@@ -554,13 +579,13 @@ void EditorApp::saveProject(QString fileName)
 			out << op;
 
 		// Song metadata
-		out << Operation("META", "TITLE", song->title)
-			<< Operation("META", "ARTIST", song->artist)
-			<< Operation("META", "GENRE", song->genre)
-			<< Operation("META", "DATE", song->year)
-			<< Operation("META", "MUSICFILE", song->music["EDITOR"])
-			<< Operation("META", "VIDEOFILE", song->video)
-			<< Operation("META", "BPM", toQString(song->bpm));
+		out << Operation::meta("TITLE", song->title)
+			<< Operation::meta("ARTIST", song->artist)
+			<< Operation::meta("GENRE", song->genre)
+			<< Operation::meta("DATE", song->year)
+			<< Operation::meta("MUSICFILE", song->music["EDITOR"])
+			<< Operation::meta("VIDEOFILE", song->video)
+			<< Operation::meta("BPM", toQString(song->bpm));
 
 		projectFileName = fileName;
 		setWindowModified(false);
@@ -602,6 +627,28 @@ void EditorApp::on_actionEnhanced_LRC_triggered() { exportSong("ENHANCED LRC", t
 
 void EditorApp::on_actionSoramimiTXT_triggered() { exportSong("SMM", tr("Export Soramimi TXT")); }
 
+void EditorApp::on_actionGuideTrack_triggered()
+{
+	QString fileName = QFileDialog::getSaveFileName(this, tr("Export guide track"), latestPath,
+		tr("WAV audio (*.wav);;FLAC audio (*.flac)"));
+	if (fileName.isNull()) return;
+	latestPath = QFileInfo(fileName).path();
+	QString music = song->music["EDITOR"];
+	if (!music.isEmpty() && QMessageBox::question(this, tr("Export guide track"), tr("Mix the guide melody with the music?"),
+	  QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes) == QMessageBox::No)
+		music.clear();
+	QApplication::setOverrideCursor(Qt::WaitCursor);
+	try {
+		GuideTrack guide(noteGraph->getVocalTrack(), music.toLocal8Bit().data());
+		guide.write(fileName.toLocal8Bit().data());
+	} catch (const std::exception& e) {
+		QApplication::restoreOverrideCursor();
+		QMessageBox::critical(this, tr("Error exporting guide track!"), e.what());
+		return;
+	}
+	QApplication::restoreOverrideCursor();
+}
+
 
 void EditorApp::on_actionLyricsToFile_triggered()
 {
@@ -636,14 +683,15 @@ void EditorApp::on_actionUndo_triggered()
 {
 	if (opStack.isEmpty())
 		return;
-	if (opStack.top().op() == "BLOCK") {
+	if (opStack.top().type == Operation::BLOCK) {
 		updateMenuStates();
 		return;
-	} else if (opStack.top().op() == "COMBINER") {
+	} else if (opStack.top().type == Operation::COMBINER) {
 		// Special handling to add the ops in the right order
 		try {
-			int count = opStack.top().i(1);
+			int count = opStack.top().id;
 			int start = opStack.size() - count - 1;
+			if (count < 0 || start < 0) throw std::runtime_error("Invalid COMBINER");
 			for (int i = start; i < start + count; ++i) {
 				redoStack.push(opStack.at(i));
 			}
@@ -661,11 +709,12 @@ void EditorApp::on_actionRedo_triggered()
 {
 	if (redoStack.isEmpty())
 		return;
-	else if (redoStack.top().op() == "COMBINER") {
+	else if (redoStack.top().type == Operation::COMBINER) {
 		// Special handling to add the ops in the right order
 		try {
-			int count = redoStack.top().i(1);
+			int count = redoStack.top().id;
 			int start = redoStack.size() - count - 1;
+			if (count < 0 || start < 0) throw std::runtime_error("Invalid COMBINER");
 			for (int i = start; i < start + count; ++i) {
 				opStack.push(redoStack.at(i));
 			}
@@ -700,6 +749,19 @@ void EditorApp::on_actionAntiAliasing_toggled(bool checked)
 	settings.setValue("anti-aliasing", checked);
 }
 
+void EditorApp::on_actionMusicIsVocals_toggled(bool)
+{
+	// Analyze again with the other engine (also called by readSettings before there is a song)
+	if (!song || !noteGraph || song->music["EDITOR"].isEmpty()) return;
+	noteGraph->analyzeMusic(song->music["EDITOR"], 0, pitchEngine(true));
+}
+
+void EditorApp::on_actionAdditionalMusicIsVocals_toggled(bool)
+{
+	if (!song || !noteGraph || song->music["ADDITIONAL"].isEmpty()) return;
+	noteGraph->analyzeMusic(song->music["ADDITIONAL"], 1, pitchEngine(false));
+}
+
 
 
 // Insert menu
@@ -713,11 +775,18 @@ void EditorApp::setMusic(QString filepath, bool primary)
 	updateMenuStates();
 	if (primary) {
 		// Metadata is updated when it becomes available (signal)
-		player->setMedia(QMediaContent(QUrl::fromLocalFile(filepath)));
+		player->setFile(filepath);
 		noteGraph->updateMusicPos(0, false);
 		// Fire up analyzer
-		noteGraph->analyzeMusic(filepath);
-	} else noteGraph->analyzeMusic(filepath, 1);
+		noteGraph->analyzeMusic(filepath, 0, pitchEngine(true));
+	} else noteGraph->analyzeMusic(filepath, 1, pitchEngine(false));
+}
+
+PitchEngine::Type EditorApp::pitchEngine(bool primary) const
+{
+	// Isolated vocals are a single voice, mixed music needs the polyphonic analyzer
+	bool vocals = (primary ? ui.actionMusicIsVocals : ui.actionAdditionalMusicIsVocals)->isChecked();
+	return vocals ? PitchEngine::YIN : PitchEngine::HARMONIC;
 }
 
 void EditorApp::setVideo(QString filepath)
@@ -919,25 +988,27 @@ void EditorApp::updateSongMeta(bool readFromSongToUI)
 void EditorApp::metaDataChanged()
 {
 	if (player) {
-		//foreach (const QString& str, player->availableMetaData())
-		//	qDebug() << str;
-		if (!player->metaData("Title").toString().isEmpty())
-			song->title = player->metaData("Title").toString();
-		if (!player->metaData("AlbumArtist").toString().isEmpty())
-			song->artist = player->metaData("AlbumArtist").toString();
-		if (!player->metaData("Genre").toString().isEmpty())
-			song->genre = player->metaData("Genre").toString();
-		if (!player->metaData("Year").toString().isEmpty())
-			song->year = player->metaData("Year").toString();
-		if (!player->metaData("BPM").toString().isEmpty())
-			song->bpm = player->metaData("BPM").toDouble();
+		QString artist = player->metaData("album_artist");
+		if (artist.isEmpty()) artist = player->metaData("artist");
+		QString bpm = player->metaData("tbpm");
+		if (bpm.isEmpty()) bpm = player->metaData("bpm");
+		if (!player->metaData("title").isEmpty())
+			song->title = player->metaData("title");
+		if (!artist.isEmpty())
+			song->artist = artist;
+		if (!player->metaData("genre").isEmpty())
+			song->genre = player->metaData("genre");
+		if (!player->metaData("date").isEmpty())
+			song->year = player->metaData("date").left(4);
+		if (!bpm.isEmpty())
+			song->bpm = bpm.toDouble();
 		updateSongMeta(true);
 	}
 }
 
 void EditorApp::playButton()
 {
-	if (player && player->state() == QMediaPlayer::PlayingState) {
+	if (player && player->state() == AudioPlayer::PlayingState) {
 		ui.cmdPlay->setText(tr("Pause (P)"));
 		ui.cmdPlay->setIcon(QIcon::fromTheme("media-playback-pause", QIcon(":/icons/media-playback-pause.png")));
 		ui.cmdPlay->setShortcut(QKeySequence("P"));
@@ -952,11 +1023,19 @@ void EditorApp::playButton()
 
 void EditorApp::on_chkSynth_clicked(bool checked)
 {
-	if (checked && player && player->state() == QMediaPlayer::PlayingState) {
-		synth.reset(new Synth);
-		connect(synth.data(), SIGNAL(playBuffer(QByteArray)), this, SLOT(playBuffer(QByteArray)));
+	if (checked && player && player->state() == AudioPlayer::PlayingState) {
+		if (!synth) {
+			synth.reset(new Synth);
+			updateSynthNotes();
+		}
 		if (player) player->setVolume(66);
 	} else if (!checked) {
+		if (synth) {
+			// Timing of the playback that just ended, to spot latency or clock problems
+			Synth::Stats st = synth->stats();
+			if (st.notes) statusBar()->showMessage(tr("Synth: %1 notes (%2 late), latency %3 ms, jitter %4 ms (max %5 ms)")
+				.arg(st.notes).arg(st.lateNotes).arg(qRound(1000 * st.latency)).arg(qRound(1000 * st.jitter)).arg(qRound(1000 * st.maxClockError)), 10000);
+		}
 		synth.reset();
 		if (player) player->setVolume(100);
 	}
@@ -965,11 +1044,10 @@ void EditorApp::on_chkSynth_clicked(bool checked)
 void EditorApp::on_cmdPlay_clicked()
 {
 	if (player) {
-		// Can't use currentMedia().isNull() because it will always return false after first set
-		if (player->currentMedia().canonicalUrl().isEmpty()) {
+		if (player->fileName().isEmpty()) {
 			on_actionMusicFile_triggered();
 		} else {
-			if (player->state() == QMediaPlayer::PlayingState) player->pause();
+			if (player->state() == AudioPlayer::PlayingState) player->pause();
 			else player->play();
 		}
 	}
@@ -977,37 +1055,47 @@ void EditorApp::on_cmdPlay_clicked()
 
 void EditorApp::audioTick(qint64 time)
 {
-	if (noteGraph && player)
-		noteGraph->updateMusicPos(time, (player->state() == QMediaPlayer::PlayingState ? true : false));
-
-	if (noteGraph && synth) {
-		// Here we create some notes for the synthesizer to use.
-		// We don't simply pass the whole list because then there
-		// would be two threads working on the same list.
-		SynthNotes notes;
-		const NoteLabels &nls = noteGraph->noteLabels();
-		int numberOfNotesToPass = 12;
-		for (NoteLabels::const_iterator it = nls.begin(); it != nls.end() && numberOfNotesToPass > 0; ++it) {
-			if ((*it)->note().begin >= time / 1000.0) {
-				notes.push_back(SynthNote((*it)->note()));
-				--numberOfNotesToPass;
-			}
-		}
-		synth->tick(time, player ? player->playbackRate() : 1.0, notes);
-	}
+	// The player reports its exact position often enough, no need to extrapolate in between
+	if (noteGraph) noteGraph->updateMusicPos(time, false);
+
+	// The synth follows the audio clock between these, the ticks only keep it in sync
+	if (synth) synth->tick(time, player ? player->playbackRate() : 1.0);
+}
+
+void EditorApp::updateSynthNotes()
+{
+	if (!noteGraph || !synth) return;
+	SynthNotes notes;
+	const NoteLabels &nls = noteGraph->noteLabels();
+	for (int i = 0; i < nls.size(); ++i)
+		notes.push_back(SynthNote(nls[i]->note()));
+	synth->setNotes(notes);
 }
 
-void EditorApp::playerStateChanged(QMediaPlayer::State state)
+void EditorApp::playerStateChanged(AudioPlayer::State state)
 {
 	playButton();
-	if (state != QMediaPlayer::PlayingState) {
+	if (state != AudioPlayer::PlayingState) {
 		noteGraph->stopMusic();
 	} else if (!noteGraph->selectedNote() && !noteGraph->noteLabels().isEmpty()) {
 		noteGraph->selectNote(noteGraph->noteLabels().front());
 	}
 }
 
-void EditorApp::playerError(QMediaPlayer::Error)
+void EditorApp::timeSyllable()
+{
+	// Time the note by what is heard at the moment of the key press, not by the last tick
+	if (player) noteGraph->updateMusicPos(player->position(), false);
+	noteGraph->timeSyllable();
+}
+
+void EditorApp::timeSentence()
+{
+	if (player) noteGraph->updateMusicPos(player->position(), false);
+	noteGraph->timeSentence();
+}
+
+void EditorApp::playerError()
 {
 	QString errst(tr("Error playing audio!"));
 	if (player) errst += " " + player->errorString();
@@ -1019,12 +1107,6 @@ void EditorApp::playbackRateChanged(qreal rate)
 	if (noteGraph) noteGraph->playbackRateChanged(rate);
 }
 
-void EditorApp::playBuffer(const QByteArray& buffer)
-{
-	if (bufferPlayers[currentBufferPlayer]->play(buffer))
-		currentBufferPlayer = (currentBufferPlayer+1) % 2;
-}
-
 
 void EditorApp::on_txtTitle_editingFinished() { updateSongMeta(); }
 void EditorApp::on_txtArtist_editingFinished() { updateSongMeta(); }
@@ -1102,12 +1184,16 @@ void EditorApp::readSettings()
 	QSize size = settings.value("size", QSize(800, 600)).toSize();
 	bool maximized = settings.value("maximized", false).toBool();
 	bool aa = settings.value("anti-aliasing", true).toBool();
+	bool musicVocals = settings.value("music-vocals", false).toBool();
+	bool additionalVocals = settings.value("additional-music-vocals", false).toBool();
 	latestPath = settings.value("latestpath", QDir::homePath()).toString();
 	// Apply them
 	if (!pos.isNull()) move(pos);
 	resize(size);
 	if (maximized) showMaximized();
 	ui.actionAntiAliasing->setChecked(aa);
+	ui.actionMusicIsVocals->setChecked(musicVocals);
+	ui.actionAdditionalMusicIsVocals->setChecked(additionalVocals);
  }
 
 void EditorApp::writeSettings()
@@ -1117,6 +1203,8 @@ void EditorApp::writeSettings()
 	settings.setValue("size", size());
 	settings.setValue("maximized", isMaximized());
 	settings.setValue("anti-aliasing", ui.actionAntiAliasing->isChecked());
+	settings.setValue("music-vocals", ui.actionMusicIsVocals->isChecked());
+	settings.setValue("additional-music-vocals", ui.actionAdditionalMusicIsVocals->isChecked());
 	settings.setValue("latestpath", latestPath);
  }
 
@@ -1157,7 +1245,7 @@ AboutDialog::AboutDialog(QWidget* parent)
 namespace {
 	bool selectionMatches(int n, NoteGraphWidget *ngw) {
 		if (!ngw) return false;
-		const NoteLabels& nls = ngw->selectedNotes();
+		NoteLabels nls = ngw->selectedNotes();
 		for (int i = 0; i < nls.size(); ++i)
 			if (nls[i]->note().note == n) return true;
 		return false;
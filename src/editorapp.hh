@@ -7,7 +7,7 @@
 #include "synth.hh"
 #include "scrollbar.hh"
 #include "notegraphwidget.hh"
-#include <QMediaPlayer>
+#include "audioplayer.hh"
 
 class QProgressBar;
 class QPushButton;
@@ -57,6 +57,7 @@ public:
 private:
 	void setupNoteGraph();
 	void setMusic(QString filepath, bool primary = true);
+	PitchEngine::Type pitchEngine(bool primary) const;
 	void setVideo(QString filepath);
 	void setBPM(double);
 	bool promptSaving();
@@ -64,19 +65,22 @@ private:
 	void exportSong(QString format, QString dialogTitle);
 	void doOpStack();
 	void playButton();
+	void updateSynthNotes();  ///< Give a running synth a snapshot of the notes (after committed edits, not every layout)
 	void readSettings();
 	void writeSettings();
 
 public slots:
 	void operationDone(const Operation &op);
+	void operationsDone(const QList<Operation> &ops);
 	void updateNoteInfo(NoteLabel *note);
 	void analyzeProgress(int value, int maximum);
 	void metaDataChanged();
 	void audioTick(qint64 time);
-	void playerStateChanged(QMediaPlayer::State state);
-	void playerError(QMediaPlayer::Error error);
+	void playerStateChanged(AudioPlayer::State state);
+	void playerError();
+	void timeSyllable();
+	void timeSentence();
 	void playbackRateChanged(qreal rate);
-	void playBuffer(const QByteArray& buffer);
 	void statusBarMessage(const QString& message);
 	void updatePiano(int y);
 	void clearLabelHighlights();
@@ -97,6 +101,7 @@ public slots:
 	void on_actionLRC_triggered();
 	void on_actionEnhanced_LRC_triggered();
 	void on_actionSoramimiTXT_triggered();
+	void on_actionGuideTrack_triggered();
 	void on_actionLyricsToFile_triggered();
 	void on_actionLyricsToClipboard_triggered();
 	void on_actionExit_triggered();
@@ -108,6 +113,8 @@ public slots:
 	void on_actionSelectAll_triggered();
 	void on_actionSelectAllAfter_triggered();
 	void on_actionAntiAliasing_toggled(bool checked);
+	void on_actionMusicIsVocals_toggled(bool checked);
+	void on_actionAdditionalMusicIsVocals_toggled(bool checked);
 
 	// Insert menu
 	void on_actionMusicFile_triggered();
@@ -154,15 +161,13 @@ private:
 	OperationStack opStack;
 	OperationStack redoStack;
 	QScopedPointer<Song> song;
-	QMediaPlayer *player;
-	BufferPlayer *bufferPlayers[2];
+	AudioPlayer *player;
 	QScopedPointer<Synth> synth;
 	Piano *piano;
 	QProgressBar *statusbarProgress;
 	QPushButton *statusbarButton;
 	QString projectFileName;
 	QString latestPath;
-	int currentBufferPlayer;
 	ScrollBar* m_scrollBar = nullptr;
 	bool m_scrollBarNeedUpdate = true;
 };
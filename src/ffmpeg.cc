@@ -1,6 +1,8 @@
 #include "ffmpeg.hh"
 #include "config.hh"
 #include "util.hh"
+#include <cctype>
+#include <cmath>
 #include <iostream>
 #include <stdexcept>
 #include <QtGlobal>
@@ -41,9 +43,9 @@ static std::string stringFromErrorCode(int code) {
 	return buffer;
 }
 
-FFmpeg::FFmpeg(std::string const& _filename):
-  m_filename(_filename), m_quit(), m_running(), m_eof(),
-  pFormatCtx(), pAudioCodecCtx(), m_rate(48000),
+FFmpeg::FFmpeg(std::string const& _filename, unsigned rate):
+  m_filename(_filename), m_rate(rate), m_quit(), m_running(), m_eof(), m_seekTarget(getNaN()), m_skipUntil(getNaN()),
+  pFormatCtx(), pAudioCodecCtx(),
   audioStream(-1)
 {
 	open(); // Throws on error
@@ -96,6 +98,17 @@ void FFmpeg::open() {
 	}
 	if (audioStream == -1) throw std::runtime_error("No audio stream found");
 
+	// Tags of the stream override the ones of the container
+	AVDictionary *dicts[] = { pFormatCtx->metadata, pFormatCtx->streams[audioStream]->metadata };
+	for (AVDictionary *dict: dicts) {
+		AVDictionaryEntry *tag = NULL;
+		while ((tag = av_dict_get(dict, "", tag, AV_DICT_IGNORE_SUFFIX))) {
+			std::string key = tag->key;
+			for (char& c: key) c = std::tolower(static_cast<unsigned char>(c));
+			m_metadata[key] = tag->value;
+		}
+	}
+
 	auto* codecpar = pFormatCtx->streams[audioStream]->codecpar;
 	const auto* pAudioCodec = avcodec_find_decoder(codecpar->codec_id);
 	audioQueue.setRateChannels(m_rate, 2);
@@ -164,16 +177,14 @@ void FFmpeg::seek(double time, bool wait) {
 
 void FFmpeg::seek_internal() {
 	audioQueue.reset();
-	int flags = 0;
-	// FIXME: if (m_seekTarget < position()) flags |= AVSEEK_FLAG_BACKWARD;
-	int stream = -1;
-	stream = audioStream;
+	// Without a stream index the target is in AV_TIME_BASE units, whatever the time base of the audio stream.
+	// Seeking backward lands at or before the target, never after it.
 	int64_t target = m_seekTarget * AV_TIME_BASE;
-	// FIXME: av_rescale_q not declared on recent ffmpeg
-	// Latest Performous code does not have these lines
-	//const AVRational time_base_q = { 1, AV_TIME_BASE };  // AV_TIME_BASE_Q is the same thing with C99 struct literal (not supported by MSVC)
-	//if (stream != -1) target = av_rescale_q(target, time_base_q, pFormatCtx->streams[stream]->time_base);
-	av_seek_frame(pFormatCtx.get(), stream, target, flags);
+	av_seek_frame(pFormatCtx.get(), -1, target, AVSEEK_FLAG_BACKWARD);
+	avcodec_flush_buffers(pAudioCodecCtx.get());
+	// The seek lands on an earlier packet, the samples before the target are dropped when decoded
+	m_skipUntil = m_seekTarget;
+	audioQueue.setEof(false);
 	m_seekTarget = getNaN(); // Signal that seeking is done
 }
 
@@ -208,6 +219,7 @@ void FFmpeg::decodeNextFrame() {
 	while (!frameFinished) {
 		ReadFramePacket packet(pFormatCtx.get());
 		if (packet.stream_index==audioStream) {
+			double packetTime = packet.time();
 			auto err = avcodec_send_packet(pAudioCodecCtx.get(), &packet);
 			if (err == AVERROR_EOF) break; // Nothing we can do
 			if (err != 0 && err != AVERROR(EAGAIN)) throw std::runtime_error(std::string("Can't send packet. Error: ") + std::to_string(err) + " " + stringFromErrorCode(err));
@@ -230,10 +242,17 @@ void FFmpeg::decodeNextFrame() {
 				av_samples_alloc((uint8_t**)&output, &out_linesize, 2, out_samples,AV_SAMPLE_FMT_S16, 0);
 				out_samples = swr_convert(m_resampleContext.get(), (uint8_t**)&output, out_samples, (const uint8_t**)&m_frame->data[0], m_frame->nb_samples);
 				std::vector<int16_t> m_output(output, output+out_samples*2);
+				av_freep(&output);
+				// Drop the samples before the seek target (if the packet time is known)
+				int skip = 0;
+				if (m_skipUntil == m_skipUntil) {
+					if (packetTime == packetTime) skip = clamp<int>(std::lround((m_skipUntil - packetTime) * m_rate), 0, out_samples);
+					if (skip < out_samples) m_skipUntil = getNaN();
+				}
+				packetTime += double(out_samples) / m_rate; // The next frame of the same packet
 				// Output samples
-				int outsize = m_output.size(); /* Convert bytes into samples */ \
-				short* samples = reinterpret_cast<short*>(&m_output[0]);\
-				audioQueue.input(samples, samples + outsize, 1.0 / 32767.0);\
+				short* samples = reinterpret_cast<short*>(&m_output[0]);
+				audioQueue.input(samples + 2 * skip, samples + 2 * out_samples, 1.0 / 32767.0);
 			}
 			while (true);
 
@@ -243,3 +262,82 @@ void FFmpeg::decodeNextFrame() {
 	}
 }
 
+namespace {
+	struct OutputContextDeleter {
+		void operator ()(AVFormatContext* context) {
+			if (context->pb) avio_closep(&context->pb);
+			avformat_free_context(context);
+		}
+	};
+	struct FrameDeleter { void operator ()(AVFrame* frame) { av_frame_free(&frame); } };
+	struct PacketDeleter { void operator ()(AVPacket* packet) { av_packet_free(&packet); } };
+}
+
+void writeAudioFile(std::string const& file, std::vector<da::sample_t> const& pcm, unsigned rate, unsigned channels) {
+	AVFormatContext* context = NULL;
+	avformat_alloc_output_context2(&context, NULL, NULL, file.c_str());
+	if (!context) throw std::runtime_error("Unknown audio file format: " + file);
+	std::unique_ptr<AVFormatContext, OutputContextDeleter> formatCtx(context);
+	const auto* codec = avcodec_find_encoder(context->oformat->audio_codec);
+	if (!codec) throw std::runtime_error("Cannot find audio encoder for " + file);
+	AVStream* stream = avformat_new_stream(context, NULL);
+	std::unique_ptr<AVCodecContext, AVCodecContextDeleter> codecCtx(avcodec_alloc_context3(codec));
+	if (!stream || !codecCtx) throw std::runtime_error("Cannot create audio encoder");
+	codecCtx->sample_rate = rate;
+	codecCtx->sample_fmt = AV_SAMPLE_FMT_S16;
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 24, 100) // FFmpeg 5.1 and up
+	av_channel_layout_default(&codecCtx->ch_layout, channels);
+#else
+	codecCtx->channels = channels;
+	codecCtx->channel_layout = av_get_default_channel_layout(channels);
+#endif
+	codecCtx->time_base = AVRational{1, int(rate)};
+	if (context->oformat->flags & AVFMT_GLOBALHEADER) codecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	{
+		QMutexLocker l(&FFmpeg::s_avcodec_mutex);
+		if (avcodec_open2(codecCtx.get(), codec, NULL) < 0) throw std::runtime_error("Cannot open audio encoder");
+	}
+	avcodec_parameters_from_context(stream->codecpar, codecCtx.get());
+	stream->time_base = codecCtx->time_base;
+	if (!(context->oformat->flags & AVFMT_NOFILE) && avio_open(&context->pb, file.c_str(), AVIO_FLAG_WRITE) < 0)
+		throw std::runtime_error("Cannot open " + file + " for writing");
+	int err = avformat_write_header(context, NULL);
+	if (err < 0) throw std::runtime_error("Cannot write audio file header: " + stringFromErrorCode(err));
+
+	std::unique_ptr<AVFrame, FrameDeleter> frame(av_frame_alloc());
+	std::unique_ptr<AVPacket, PacketDeleter> packet(av_packet_alloc());
+	// Pass a frame to the encoder (NULL flushes it) and write out the packets it has ready
+	auto encode = [&](AVFrame* f) {
+		int err = avcodec_send_frame(codecCtx.get(), f);
+		while (err >= 0) {
+			err = avcodec_receive_packet(codecCtx.get(), packet.get());
+			if (err == AVERROR(EAGAIN) || err == AVERROR_EOF) return;
+			if (err < 0) break;
+			av_packet_rescale_ts(packet.get(), codecCtx->time_base, stream->time_base);
+			packet->stream_index = stream->index;
+			err = av_interleaved_write_frame(context, packet.get());
+		}
+		throw std::runtime_error("Cannot encode audio: " + stringFromErrorCode(err));
+	};
+	const std::size_t frames = pcm.size() / channels;
+	const std::size_t frameSize = codecCtx->frame_size > 0 ? codecCtx->frame_size : 4096;
+	for (std::size_t pos = 0; pos < frames; pos += frameSize) {
+		frame->nb_samples = std::min(frameSize, frames - pos);
+		frame->format = codecCtx->sample_fmt;
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 24, 100) // FFmpeg 5.1 and up
+		av_channel_layout_copy(&frame->ch_layout, &codecCtx->ch_layout);
+#else
+		frame->channel_layout = codecCtx->channel_layout;
+#endif
+		if (av_frame_get_buffer(frame.get(), 0) < 0) throw std::runtime_error("Cannot allocate audio frame");
+		int16_t* out = reinterpret_cast<int16_t*>(frame->data[0]);
+		for (std::size_t i = 0; i < frame->nb_samples * channels; ++i)
+			out[i] = clamp(pcm[pos * channels + i], -1.0f, 32767.0f / 32768.0f) * 32768;
+		frame->pts = pos;
+		encode(frame.get());
+		av_frame_unref(frame.get());
+	}
+	encode(NULL);
+	err = av_write_trailer(context);
+	if (err < 0) throw std::runtime_error("Cannot finish audio file: " + stringFromErrorCode(err));
+}
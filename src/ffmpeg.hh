@@ -7,7 +7,9 @@
 #include <QWaitCondition>
 #include <QScopedPointer>
 
+#include <map>
 #include <memory>
+#include <string>
 #include <vector>
 
 class AudioQueue {
@@ -34,10 +36,12 @@ public:
 		m_eof = eof;
 		m_needData.wakeOne();
 	}
-	bool output(std::vector<da::sample_t>& out) {
+	/// Append the queued samples to out. Returns false at the end of stream (waits for data unless wait is false).
+	bool output(std::vector<da::sample_t>& out, bool wait = true) {
 		QMutexLocker lock(&m_mutex);
 		while (m_size == 0) {
 			if (m_eof) return false;
+			if (!wait) return true;
 			m_needData.wait(&m_mutex);
 		}
 		std::size_t outsz = out.size();
@@ -104,8 +108,8 @@ struct SwrContextDeleter
 /// ffmpeg class
 class FFmpeg: public QThread {
   public:
-	/// constructor
-	FFmpeg(std::string const& file);
+	/// constructor (the output is resampled to rate)
+	FFmpeg(std::string const& file, unsigned rate = 48000);
 	~FFmpeg();
 	/// Thread runs here, don't call directly
 	void run();
@@ -115,9 +119,14 @@ class FFmpeg: public QThread {
 	void seek(double time, bool wait = true);
 	/// Duration
 	double duration() const;
+	/// Tags of the file and its audio stream (FFmpeg keys, e.g. "title", "album_artist", "date")
+	std::map<std::string, std::string> const& metadata() const { return m_metadata; }
+	/// Output sample rate (the output is always stereo)
+	unsigned rate() const { return m_rate; }
 	bool terminating() const { return m_quit; }
 
   private:
+	friend void writeAudioFile(std::string const&, std::vector<da::sample_t> const&, unsigned, unsigned);
 	class eof_error: public std::exception {};
 	void seek_internal();
 	void open();
@@ -128,6 +137,8 @@ class FFmpeg: public QThread {
 	volatile bool m_running;
 	volatile bool m_eof;
 	volatile double m_seekTarget;
+	double m_skipUntil; ///< Time of the seek target until decoded samples are discarded (NaN = none)
+	std::map<std::string, std::string> m_metadata;
 	std::unique_ptr<AVFormatContext, AVFormatContextDeleter> pFormatCtx;
 	std::unique_ptr<SwrContext, SwrContextDeleter> m_resampleContext;
 	std::unique_ptr<AVCodecContext, AVCodecContextDeleter> pAudioCodecCtx;
@@ -136,3 +147,5 @@ class FFmpeg: public QThread {
 	static QMutex s_avcodec_mutex; // Used for avcodec_open/close (which use some static crap and are thus not thread-safe)
 };
 
+/// Encode interleaved samples (-1..1) to a file in the format of its extension (e.g. FLAC). Throws on error.
+void writeAudioFile(std::string const& file, std::vector<da::sample_t> const& pcm, unsigned rate, unsigned channels);
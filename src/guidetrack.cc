@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "guidetrack.hh"
+#include "ffmpeg.hh"
+#include "synth.hh"
+#include "util.hh"
+
+namespace {
+	const unsigned defaultRate = 48000; ///< Without music (the rate FFmpeg decodes to otherwise)
+	const double tail = 1.0; ///< Silence after the last note (seconds)
+	const float guideVolume = 1.5f; ///< The synth is quiet for live playback, boost it against the music
+}
+
+GuideTrack::GuideTrack(const VocalTrack& track, const std::string& musicFile, double musicVolume)
+	: m_rate(defaultRate), m_channels(1)
+{
+	std::vector<da::sample_t> music;
+	if (!musicFile.empty()) {
+		FFmpeg decoder(musicFile); // Throws on error
+		m_rate = decoder.rate();
+		m_channels = 2;
+		while (decoder.audioQueue.output(music)) {} // Decodes as fast as it can
+	}
+
+	SynthNotes notes;
+	double end = 0.0;
+	for (Notes::const_iterator it = track.notes.begin(); it != track.notes.end(); ++it) {
+		if (it->type == Note::SLEEP) continue;
+		notes.push_back(SynthNote(*it));
+		end = std::max(end, it->end);
+	}
+	std::sort(notes.begin(), notes.end());
+
+	const std::size_t frames = std::max<std::size_t>(music.size() / m_channels, (end + tail) * m_rate);
+	std::vector<float> guide = Synth::render(notes, m_rate, frames);
+	m_pcm.assign(frames * m_channels, 0.0f);
+	for (std::size_t i = 0; i < frames; ++i) {
+		for (unsigned ch = 0; ch < m_channels; ++ch) {
+			std::size_t pos = i * m_channels + ch;
+			m_pcm[pos] = guideVolume * guide[i] + (pos < music.size() ? musicVolume * music[pos] : 0.0f);
+		}
+	}
+}
+
+void GuideTrack::write(const std::string& fileName) const
+{
+	std::string ext = fileName.substr(std::min(fileName.size(), fileName.rfind('.')));
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+	if (ext == ".wav") writeWav(fileName);
+	else writeAudioFile(fileName, m_pcm, m_rate, m_channels);
+}
+
+void GuideTrack::writeWav(const std::string& fileName) const
+{
+	std::ofstream f(fileName.c_str(), std::ios::binary);
+	if (!f) throw std::runtime_error("Couldn't open file " + fileName + " for writing");
+	f << Synth::writeWavHeader(16, m_channels, m_rate, m_pcm.size() / m_channels);
+	std::vector<char> data(m_pcm.size() * 2);
+	for (std::size_t i = 0; i < m_pcm.size(); ++i) {
+		qint16 svalue = clamp(m_pcm[i], -1.0f, 32767.0f / 32768.0f) * 32768;
+		std::memcpy(&data[2 * i], &svalue, 2);
+	}
+	f.write(data.data(), data.size());
+	if (!f) throw std::runtime_error("Error writing " + fileName);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "notes.hh"
+
+/**
+ * @brief Offline rendering of the notes as a guide melody.
+ *
+ * The notes are synthesized with the Synth timbre faster than real time and
+ * optionally mixed over the decoded music, so that charts can be checked by
+ * listening elsewhere.
+ */
+class GuideTrack
+{
+public:
+	/// Render track, mixed over the music of musicFile unless it is empty
+	GuideTrack(const VocalTrack& track, const std::string& musicFile = std::string(), double musicVolume = 0.5);
+	/// Write WAV, or any other format FFmpeg can encode by the extension (e.g. FLAC). Throws on error.
+	void write(const std::string& fileName) const;
+
+	unsigned rate() const { return m_rate; }
+	unsigned channels() const { return m_channels; }
+
+private:
+	void writeWav(const std::string& fileName) const;
+
+	unsigned m_rate;
+	unsigned m_channels;
+	std::vector<float> m_pcm; ///< Interleaved samples
+};
@@ -3,6 +3,7 @@
 #include <iostream>
 #include "config.hh"
 #include "editorapp.hh"
+#include "cli.hh"
 
 #ifdef STATIC_PLUGINS
 #include <QtPlugin>
@@ -11,6 +12,13 @@ Q_IMPORT_PLUGIN(QWindowsIntegrationPlugin)
 
 int main(int argc, char *argv[])
 {
+	// Batch commands run without a display
+	if (argc > 1 && Cli::isCommand(argv[1])) {
+		QCoreApplication app(argc, argv);
+		app.setApplicationName(PACKAGE);
+		return Cli::run(app.arguments());
+	}
+
 	Q_INIT_RESOURCE(editor);
 
 	QApplication app(argc, argv);
@@ -37,6 +45,7 @@ int main(int argc, char *argv[])
 				<< "-h [ --help ]      you are viewing it" << std::endl
 				<< "-v [ --version ]   display version number" << std::endl
 				<< "argument without a switch is interpreted as a song file to open" << std::endl
+				<< std::endl << "batch commands (no display needed):" << std::endl << Cli::usage()
 				;
 			exit(EXIT_SUCCESS);
 		}
@@ -1,4 +1,5 @@
 #include <QMouseEvent>
+#include <QHelpEvent>
 #include <QKeyEvent>
 #include <QScrollArea>
 #include <QScrollBar>
@@ -7,6 +8,7 @@
 #include <QToolTip>
 #include <QMessageBox>
 #include <QMimeData>
+#include <QApplication>
 #include <iostream>
 #include <algorithm>
 #include <cmath>
@@ -18,12 +20,6 @@
 
 
 namespace {
-	static Operation opFromNote(const Note& note, int id, bool floating) {
-		Operation op("NEW");
-		op << id << note.syllable << note.begin << note.end << note.note << floating << note.lineBreak << note.getTypeInt();
-		return op;
-	}
-
 	static const double endMarginSeconds = 5.0;
 }
 
@@ -31,9 +27,9 @@ namespace {
 /*static*/ const QString NoteGraphWidget::BGColor = "#222";
 
 NoteGraphWidget::NoteGraphWidget(QWidget *parent)
-	: NoteLabelManager(parent), m_mouseHotSpot(), m_seeking(), m_actionHappened(),
-	m_seekHandle(this), m_nextNotePixmap(), m_notePixmapTimer(), m_analyzeTimer(),
-	m_playbackTimer(), m_playbackPos(), m_playbackRate(1.0), m_pixmap(), m_pixmapPos()
+	: NoteLabelManager(parent), m_mouseHotSpot(), m_actionNote(), m_resizeDir(), m_dragHotSpot(),
+	m_seeking(), m_actionHappened(), m_seekHandle(this), m_analyzeTimer(),
+	m_playbackTimer(), m_playbackPos(), m_playbackRate(1.0), m_pixmap(), m_pixmapPos(), m_pixmapScale()
 {
 	setProperty("darkBackground", true);
 	setStyleSheet("QLabel[darkBackground=\"true\"] { background: " + BGColor + "; }");
@@ -63,7 +59,8 @@ void NoteGraphWidget::setLyrics(QString lyrics)
 	BusyDialog busy(this, 2);
 	QTextStream ts(&lyrics, QIODevice::ReadOnly);
 
-	doOperation(Operation("CLEAR"));
+	doOperation(Operation(Operation::CLEAR));
+	beginBatch(); // Committed by finalizeNewLyrics
 	bool firstNote = true;
 	while (!ts.atEnd()) {
 		busy();
@@ -80,7 +77,7 @@ void NoteGraphWidget::setLyrics(QString lyrics)
 				for(int i = 0; i < syllables.size(); i++) {
 					Note note(syllables[i]); note.end = NoteLabel::default_length; note.note = 24;
 					if (sentenceStart) note.lineBreak = true;
-					doOperation(opFromNote(note, m_notes.size(), !firstNote), Operation::NO_UPDATE);
+					doOperation(Operation::newNote(m_notes.size(), note, !firstNote));
 					firstNote = false;
 					sentenceStart = false;
 				}
@@ -96,12 +93,13 @@ void NoteGraphWidget::setLyrics(QString lyrics)
 void NoteGraphWidget::setLyrics(const VocalTrack &track)
 {
 	BusyDialog busy(this, 10);
-	doOperation(Operation("CLEAR"));
+	doOperation(Operation(Operation::CLEAR));
+	beginBatch(); // Committed by finalizeNewLyrics
 	m_songLengthInSeconds = std::max(m_songLengthInSeconds, track.endTime + endMarginSeconds);
 	const Notes &notes = track.notes;
 	for (Notes::const_iterator it = notes.begin(); it != notes.end(); ++it) {
 		if (it->type == Note::SLEEP) continue;
-		doOperation(opFromNote(*it, m_notes.size(), false), Operation::NO_UPDATE);
+		doOperation(Operation::newNote(m_notes.size(), *it, false));
 		busy();
 	}
 
@@ -110,51 +108,42 @@ void NoteGraphWidget::setLyrics(const VocalTrack &track)
 
 void NoteGraphWidget::finalizeNewLyrics()
 {
-	int ops = m_notes.size();
 	// Set the last note to non-floating and to the end of the song
-	if (ops > 1 && m_notes[ops-1]->isFloating()) {
-		doOperation(Operation("FLOATING", (int)m_notes.size()-1, false));
-		Operation moveop("MOVE");
-		moveop << (int)m_notes.size()-1
-			<< m_songLengthInSeconds - NoteLabel::default_length - endMarginSeconds
-			<< m_songLengthInSeconds - endMarginSeconds
-			<< m_notes.back()->note().note;
-		doOperation(moveop);
-		ops += 2; // Amount of extra Operations added here
+	if (m_notes.size() > 1 && m_notes.back()->isFloating()) {
+		doOperation(Operation(Operation::FLOATING, (int)m_notes.size()-1, false));
+		doOperation(Operation::move(m_notes.size()-1,
+			m_songLengthInSeconds - NoteLabel::default_length - endMarginSeconds,
+			m_songLengthInSeconds - endMarginSeconds,
+			m_notes.back()->note().note));
 	}
 
-	// Combine the import into one undo action
-	doOperation(Operation("COMBINER", ops));
-
-	// Make sure there is enough room
-	if (!m_notes.isEmpty())
-		setFixedWidth(std::max<int>(width(), s2px(m_songLengthInSeconds)));
+	// Calculate floating note positions and combine the import into one undo action
+	commitBatch();
 
-	// Calculate floating note positions
-	updateNotes();
+	// Make sure the whole song can be scrolled to
+	updateScrollBar();
 
 	// Scroll to show the first note
 	scrollToFirstNote();
-
-	// Start creating pixmaps for notes
-	startNotePixmapUpdates();
 }
 
 void NoteGraphWidget::scrollToFirstNote()
 {
-	QScrollArea* scrollArea = getScrollArea();
-	if (scrollArea && !m_notes.isEmpty()) {
-		const Note& n = m_notes.front()->note();
-		int w = scrollArea->width();
-		scrollArea->ensureVisible(s2px(n.begin) + w/3, n2px(n.note), w/2, scrollArea->height()/2);
-	}
+	if (m_notes.isEmpty()) return;
+	const Note& n = m_notes.front()->note();
+	// Put the note at a third of the view if it is not in the middle part already
+	int x = s2px(n.begin);
+	if (x < width() / 6 || x > width() * 5 / 6) setViewBegin(n.begin - width() / 3 / m_pixelsPerSecond);
+	if (QScrollArea* scrollArea = getScrollArea())
+		scrollArea->ensureVisible(width() / 2, n2px(n.note), 0, scrollArea->height()/2);
 }
 
-void NoteGraphWidget::analyzeMusic(QString filepath, int visId)
+void NoteGraphWidget::analyzeMusic(QString filepath, int visId, PitchEngine::Type engine)
 {
-	m_pitch[visId].reset(new PitchVis(filepath, this, visId));
-	connect(m_pitch[visId].data(), SIGNAL(renderedImage(QImage,QPoint,int)), this, SLOT(updatePixmap(QImage,QPoint,int)));
+	m_pitch[visId].reset(new PitchVis(filepath, this, visId, engine));
+	connect(m_pitch[visId].data(), SIGNAL(renderedImage(QImage,QPoint,double,int)), this, SLOT(updatePixmap(QImage,QPoint,double,int)));
 	m_analyzeTimer = startTimer(100);
+	invalidateLayout();
 }
 
 void NoteGraphWidget::timerEvent(QTimerEvent* event)
@@ -167,50 +156,29 @@ void NoteGraphWidget::timerEvent(QTimerEvent* event)
 	} else if (event->timerId() == m_analyzeTimer && m_pitch[0]) {
 		// PitchVis stuff
 		double progress = 1.0, duration;
+		bool updated = false;
 		for (int i = 0; i < MaxPitchVis; ++i) {
 			if (!m_pitch[i]) continue;
 			QMutexLocker locker(&m_pitch[i]->mutex);
 			progress = std::min(progress, m_pitch[i]->getProgress());
 			if (i == 0) duration = m_pitch[i]->getDuration();
+			updated = updated || m_pitch[i]->newDataAvailable();
 		}
 		emit analyzeProgress(1000 * progress, 1000); // Update progress bar
-		m_songLengthInSeconds = std::max(m_songLengthInSeconds, duration);
-		// Analyzing has ended?
-		if (progress == 1.0) {
-			killTimer(m_analyzeTimer);
-			updatePitch();
+		if (duration > m_songLengthInSeconds) {
+			m_songLengthInSeconds = duration;
+			updateScrollBar();
 		}
-
-	} else if (event->timerId() == m_notePixmapTimer) {
-		// Here we create a pixmap for a NoteLabel
-		if (m_nextNotePixmap >= m_notes.size()) {
-			killTimer(m_notePixmapTimer);
-			m_notePixmapTimer = 0;
-			m_nextNotePixmap = 0;
-			return;
+		// Floating notes get their pitch from the analysis, so relayout the gaps they are in
+		if (updated) {
+			int first = 0, last = m_notes.size() - 1;
+			while (first <= last && !m_notes[first]->isFloating()) ++first;
+			while (last >= first && !m_notes[last]->isFloating()) --last;
+			if (first <= last) invalidateLayout(first, last);
 		}
-		// Loop until a pixmap-to-create is found - we only create one at a time to not block the UI
-		while (m_nextNotePixmap < m_notes.size() && !m_notes[m_nextNotePixmap]->createPixmap())
-			++m_nextNotePixmap;
-		++m_nextNotePixmap;
-	}
-}
-
-void NoteGraphWidget::startNotePixmapUpdates()
-{
-	// With 0-delay, note pixmaps are created whenever there is not events to process
-	// This means fast performance while keeping snappy interface
-	if (!m_notePixmapTimer) m_notePixmapTimer = startTimer(1);
-	m_nextNotePixmap = 0;
-}
-
-void NoteGraphWidget::forcedNotePixmapUpdate()
-{
-	// Things like split and open often don't trigger the timer event, do a forced update of the pixmaps here
-	m_nextNotePixmap = 0;
-	while (m_nextNotePixmap < m_notes.size()) {
-		m_notes[m_nextNotePixmap]->createPixmap();
-		++m_nextNotePixmap;
+		// Show the paths analyzed so far, the analysis goes on until the progress is complete
+		if (progress == 1.0) killTimer(m_analyzeTimer);
+		if (updated || progress == 1.0) updatePitch();
 	}
 }
 
@@ -219,20 +187,22 @@ void NoteGraphWidget::playbackRateChanged(qreal rate)
 	m_playbackRate = rate;
 }
 
-void NoteGraphWidget::paintEvent(QPaintEvent*)
+void NoteGraphWidget::paintEvent(QPaintEvent *event)
 {
-	setFixedSize(s2px(m_songLengthInSeconds), height());
-
 	// Find out the viewport
 	int x1, y1, x2, y2;
 	calcViewport(x1, y1, x2, y2);
 
 	QPainter painter(this);
 
-	// PitchVis pixmap
+	// PitchVis pixmap (stretched to the current zoom until a new rendering arrives)
 	for (int i = 0; i < MaxPitchVis; ++i) {
-		if (!m_pixmap[i].isNull())
-			painter.drawPixmap(m_pixmapPos[i], m_pixmap[i]);
+		if (m_pixmap[i].isNull()) continue;
+		// The position is in pixels from the song start at the scale rendered with
+		double scale = m_pixelsPerSecond / m_pixmapScale[i];
+		if (scale == 1.0) painter.drawPixmap(m_pixmapPos[i] - QPoint(viewOffset(), 0), m_pixmap[i]);
+		else painter.drawPixmap(QRectF(m_pixmapPos[i].x() * scale - viewOffset(), m_pixmapPos[i].y(), m_pixmap[i].width() * scale, m_pixmap[i].height()),
+			m_pixmap[i], QRectF(m_pixmap[i].rect()));
 	}
 
 	// Octave lines
@@ -241,6 +211,11 @@ void NoteGraphWidget::paintEvent(QPaintEvent*)
 	for (int i = 1; i < 4; ++i)
 		painter.drawLine(x1, n2px(i*12), x2, n2px(i*12));
 
+	// Notes (only the ones inside the area to be painted)
+	std::vector<int> ids = findIdsInRect(event->rect());
+	for (std::size_t i = 0; i < ids.size(); ++i)
+		m_renderer.paint(painter, *m_notes[ids[i]], noteRect(m_notes[ids[i]]), m_selection.contains(ids[i]));
+
 	// Selection box
 	if (!m_mouseHotSpot.isNull()) {
 		QPoint mousep = mapFromGlobal(QCursor::pos());
@@ -250,12 +225,13 @@ void NoteGraphWidget::paintEvent(QPaintEvent*)
 	}
 }
 
-void NoteGraphWidget::updatePixmap(const QImage &image, const QPoint &position, int visId)
+void NoteGraphWidget::updatePixmap(const QImage &image, const QPoint &position, double pixelsPerSecond, int visId)
 {
 	// PitchVis sends its renderings here, let's save & draw them
 	// This gets actually called in our own thread by our own event loop (queued connection)
 	m_pixmap[visId] = QPixmap::fromImage(image);
 	m_pixmapPos[visId] = position;
+	m_pixmapScale[visId] = pixelsPerSecond;
 	update();
 }
 
@@ -269,78 +245,122 @@ void NoteGraphWidget::updatePitch()
 	calcViewport(x1, y1, x2, y2);
 	// Ask for a new render
 	for (int i = 0; i < MaxPitchVis; ++i)
-		if (m_pitch[i]) m_pitch[i]->paint(x1, 0, x2, height());
+		if (m_pitch[i]) m_pitch[i]->paint(viewOffset() + x1, 0, viewOffset() + x2, height(), m_pixelsPerSecond);
+}
+
+namespace {
+	/// Fixed notes (and the last note in the direction of the layout) delimit the floating gaps
+	bool isGapEnd(const NoteLabels &notes, int i, bool leftToRight) {
+		return !notes[i]->isFloating() || i == (leftToRight ? notes.size()-1 : 0);
+	}
 }
 
 void NoteGraphWidget::updateNotes(bool leftToRight)
 {
 	// Here happens the magic that adjusts the floating
 	// notes according to the fixed ones.
-	FloatingGap gap(leftToRight ? 0 : m_songLengthInSeconds);
-
-	// Determine gaps between non-floating notes
-	// Variable leftToRight controls the iteration direction.
-	for (int i = (leftToRight ? 0 : m_notes.size()-1); i >= 0 && i < m_notes.size(); i += (leftToRight ? 1 : -1)) {
-		NoteLabel *child = m_notes[i];
-		if (!child) continue;
-		Note &n = m_notes[i]->note();
-
-		if (child->isFloating() && i != (leftToRight ? m_notes.size()-1 : 0)) {
-			// Add floating note to gap
-			gap.addNote(child);
+	// The layout of a gap only depends on the fixed notes around it, so only the
+	// gaps around the notes changed since the previous call (in the same direction)
+	// are processed. A fixed note pushed aside carries the change to the next gap.
+	int first = 0, last = m_notes.size() - 1;
+	if (m_layoutDirection == (leftToRight ? 1 : -1)) {
+		first = std::max(m_layoutDirtyBegin, 0);
+		last = std::min(m_layoutDirtyEnd, m_notes.size()) - 1;
+	}
+	m_layoutDirection = leftToRight ? 1 : -1;
+	m_layoutDirtyBegin = m_layoutDirtyEnd = 0;
+
+	if (first <= last) {
+		// Start from the fixed note before the changed ones
+		// Variable leftToRight controls the iteration direction.
+		int dir = leftToRight ? 1 : -1;
+		int i = leftToRight ? first - 1 : last + 1;
+		while (i >= 0 && i < m_notes.size() && !isGapEnd(m_notes, i, leftToRight)) i -= dir;
+		int from = i;
+		double start = leftToRight ? 0 : m_songLengthInSeconds;
+		if (i >= 0 && i < m_notes.size()) start = leftToRight ? m_notes[i]->note().end : m_notes[i]->note().begin;
+		FloatingGap gap(start);
+
+		// Determine gaps between non-floating notes
+		for (i += dir; i >= 0 && i < m_notes.size(); i += dir) {
+			NoteLabel *child = m_notes[i];
+			if (!isGapEnd(m_notes, i, leftToRight)) {
+				// Add floating note to gap
+				gap.addNote(child);
+				continue;
+			}
+			// Fixed note encountered, handle the gap
+			Note &n = child->note();
+			bool moved = layoutGap(gap, n, leftToRight);
+			// Start a new gap
+			gap = FloatingGap(leftToRight ? n.end : n.begin);
+			// Past the changed notes and nothing was pushed: the rest is already laid out
+			if (!moved && (leftToRight ? i > last : i < first)) break;
+		}
+		// The notes from the starting fixed note to the last one visited may have moved
+		invalidateIndex(std::max(std::min(from, i), 0), std::min(std::max(from, i), m_notes.size() - 1));
+	}
 
-		} else {
-			// Fixed note encountered, handle the gap (divide notes evenly into it)
-			gap.end = leftToRight ? n.begin : n.end;
+	update();
+	emit updatedNotes();
+}
 
-			if (!gap.notes.isEmpty()) {
+bool NoteGraphWidget::layoutGap(FloatingGap &gap, Note &n, bool leftToRight)
+{
+	gap.end = leftToRight ? n.begin : n.end;
 
-				// Calculate note length and space between notes
-				double len = NoteLabel::min_length, step = 0; // Minimum values
-				if (gap.length() > gap.minLength()) { // Is there space?
-					len = gap.length() / double(gap.notes.size()) * 0.9;
-					step = (gap.length() - len * gap.notes.size()) / double(gap.notes.size() + 1);
-				}
+	// Move the fixed one first (probably the one being moved by user) if there is no space,
+	// so that the floating notes go into the final gap and a second pass changes nothing.
+	// The tolerance keeps rounding in Note::move from pushing the note again.
+	bool moved = false;
+	double gapl = leftToRight ? (gap.end - gap.begin) : (gap.begin - gap.end);
+	if (gapl < gap.minLength() - 1e-9) {
+		double begin = n.begin;
+		n.move(gap.begin + (leftToRight ? gap.minLength() : (-gap.minLength() - n.length())));
+		moved = (n.begin != begin);
+		gap.end = leftToRight ? n.begin : n.end;
+	}
 
-				// Calculate starting time of the first note in gap
-				double pos = gap.begin + (leftToRight ? step : (-step - len));
-
-				// Loop through all notes
-				for (NoteLabels::iterator it2 = gap.notes.begin(); it2 != gap.notes.end(); ++it2) {
-					Note &n2 = (*it2)->note();
-					// Set new note begin/end
-					n2.begin = pos;
-					n2.end = pos + len;
-					// Try to find optimal pitch
-					// TODO: Use info also from other pitchvis
-					if (m_pitch[0]) n2.note = m_pitch[0]->guessNote(pos, pos + len + step, 24);
-					// Calculate starting time for the next note
-					pos += (len + step) * (leftToRight ? 1 : -1);
-					// Update NoteLabel geometry
-					(*it2)->updateLabel();
-				}
-			}
+	// Divide the floating notes evenly into the gap
+	if (!gap.notes.isEmpty()) {
 
-			// Also move the fixed one (probably the one being moved by user) if there is no space
-			double gapl = leftToRight ? (gap.end - gap.begin) : (gap.begin - gap.end);
-			if (gapl < gap.minLength())
-				n.move(gap.begin + (leftToRight ? gap.minLength() : (-gap.minLength() - n.length())));
+		// Calculate note length and space between notes
+		double len = NoteLabel::min_length, step = 0; // Minimum values
+		if (gap.length() > gap.minLength()) { // Is there space?
+			len = gap.length() / double(gap.notes.size()) * 0.9;
+			step = (gap.length() - len * gap.notes.size()) / double(gap.notes.size() + 1);
+		}
 
-			child->updateLabel();
-			// Start a new gap
-			gap = FloatingGap(leftToRight ? n.end : n.begin);
+		// Calculate starting time of the first note in gap
+		double pos = gap.begin + (leftToRight ? step : (-step - len));
+
+		// Loop through all notes
+		for (NoteLabels::iterator it2 = gap.notes.begin(); it2 != gap.notes.end(); ++it2) {
+			Note &n2 = (*it2)->note();
+			// Set new note begin/end
+			n2.begin = pos;
+			n2.end = pos + len;
+			// Try to find optimal pitch
+			// TODO: Use info also from other pitchvis
+			if (m_pitch[0]) n2.note = m_pitch[0]->guessNote(pos, pos + len + step, 24);
+			// Calculate starting time for the next note
+			pos += (len + step) * (leftToRight ? 1 : -1);
 		}
 	}
-	
-	emit updatedNotes();
+	return moved;
 }
 
 void NoteGraphWidget::updateMusicPos(qint64 time, bool smoothing)
 {
 	m_playbackPos = time;
-	int x = s2px(m_playbackPos / 1000.0) - m_seekHandle.width() / 2;
 	if (m_playbackTimer) killTimer(m_playbackTimer);
-	m_seekHandle.move(x, 0);
+	if (m_seekHandle.wrapToViewport) {
+		// Keep the position in the left third of the view
+		double sec = m_playbackPos / 1000.0;
+		int x = s2px(sec);
+		if (x < 0 || x > width() / 3) setViewBegin(sec - (x < 0 ? 0 : width() / 3 / m_pixelsPerSecond));
+	}
+	moveSeekHandle();
 	if (smoothing) m_playbackTimer = startTimer(20); // Hope for 50 fps
 	else m_playbackTimer = 0;
 	m_playbackInterval.restart();
@@ -361,22 +381,25 @@ void NoteGraphWidget::seek(int x)
 void NoteGraphWidget::zoom(float steps, double focalSecs)
 {
 	NoteLabelManager::zoom(steps, focalSecs);
-	// Update seek handle position
-	int x = s2px(m_playbackPos / 1000.0) - m_seekHandle.width() / 2;
-	m_seekHandle.move(x, 0);
+	// The old pitch rendering is stretched meanwhile (the scroll bar might not have moved)
+	updatePitch();
+	moveSeekHandle();
+}
+
+void NoteGraphWidget::moveSeekHandle()
+{
+	m_seekHandle.move(s2px(m_playbackPos / 1000.0) - m_seekHandle.width() / 2, 0);
 }
 
 void NoteGraphWidget::timeCurrent()
 {
 	if (selectedNote()) {
-		Operation op("MOVE");
-		double begin = px2s(m_seekHandle.curx());
-		double end = px2s(m_seekHandle.curx() + selectedNote()->width());
+		double begin = m_playbackPos / 1000.0;
+		double end = begin + selectedNote()->note().length();
 		int n = selectedNote()->note().note;
 		// TODO: Use info also from other pitchvis
 		if (m_pitch[0]) n = m_pitch[0]->guessNote(begin, end, n);
-		op << getNoteLabelId(selectedNote()) << begin << end << n;
-		doOperation(op);
+		doOperation(Operation::move(getNoteLabelId(selectedNote()), begin, end, n));
 	}
 }
 
@@ -394,7 +417,7 @@ void NoteGraphWidget::timeSentence()
 
 void NoteGraphWidget::mousePressEvent(QMouseEvent *event)
 {
-	NoteLabel *child = qobject_cast<NoteLabel*>(childAt(event->pos()));
+	NoteLabel *child = noteAt(event->pos());
 	if (!child) {
 		SeekHandle *seekh = qobject_cast<SeekHandle*>(childAt(event->pos()));
 		if (!seekh) {
@@ -415,32 +438,36 @@ void NoteGraphWidget::mousePressEvent(QMouseEvent *event)
 		}
 		return;
 	}
-	if (child->isHidden()) return;
 
-	QPoint hotSpot = event->pos() - child->pos();
+	QRect rect = noteRect(child);
+	QPoint hotSpot = event->pos() - rect.topLeft();
 
 	// Left Click
 	if (event->button() == Qt::LeftButton) {
 
 		// Determine if it is drag or resize
-		if (hotSpot.x() < NoteLabel::resize_margin || hotSpot.x() > child->width() - NoteLabel::resize_margin) {
+		if (hotSpot.x() < NoteLabel::resize_margin || hotSpot.x() > rect.width() - NoteLabel::resize_margin) {
 			// Start a resize
 			selectNote(child); // Resizing will deselect everything but one
 			m_selectedAction = RESIZE;
-			child->startResizing( (hotSpot.x() < NoteLabel::resize_margin) ? -1 : 1 );
+			m_actionNote = child;
+			m_resizeDir = (hotSpot.x() < NoteLabel::resize_margin) ? -1 : 1;
+			setCursor(QCursor(Qt::SizeHorCursor));
 
 		} else {
-			if (child->isSelected()) ; // No op
+			if (isSelected(child)) ; // No op
 			// Ctrl and Shift allow selecting multiple notes for dragging
 			else if (event->modifiers() & Qt::ShiftModifier) shiftSelect(child);
 			else selectNote(child, !(event->modifiers() & Qt::ControlModifier));
 			m_selectedAction = MOVE;
-			child->startDragging(hotSpot);
+			m_actionNote = child;
+			m_dragHotSpot = hotSpot;
+			setCursor(QCursor(Qt::ClosedHandCursor));
 		}
 
 	// Middle Click
 	} else if (event->button() == Qt::MiddleButton) {
-		split(child, float(hotSpot.x()) / child->width());
+		split(child, float(hotSpot.x()) / rect.width());
 
 	// Right Click
 	} else if (event->button() == Qt::RightButton) {
@@ -450,35 +477,28 @@ void NoteGraphWidget::mousePressEvent(QMouseEvent *event)
 
 void NoteGraphWidget::mouseReleaseEvent(QMouseEvent *event)
 {
-	(void)*event;
 	if (m_selectedAction != NONE) {
 		if (selectedNote()) {
-			int movecount = 0;
-			for (int i = 0; i < m_selectedNotes.size(); ++i) {
-				NoteLabel *nl = m_selectedNotes[i];
-				nl->startResizing(0);
-				nl->startDragging(QPoint());
-				const Note& n = nl->note();
-				if (m_actionHappened) {
-					// Operation for undo stack & saving
-					Operation op("MOVE");
-					op << getNoteLabelId(nl) << n.begin << n.end << n.note;
-					doOperation(op, Operation::NO_EXEC);
-					++movecount;
+			if (m_actionHappened) {
+				// Operations for undo stack & saving, combined to one undo operation
+				beginBatch();
+				for (int i = m_selection.first(); i >= 0; i = m_selection.next(i)) {
+					const Note& n = m_notes[i]->note();
+					doOperation(Operation::move(i, n.begin, n.end, n.note), Operation::NO_EXEC);
 				}
-			}
-			// Combine to one undo operation
-			if (movecount > 1) {
-				Operation op("COMBINER"); op << movecount; doOperation(op);
+				commitBatch();
 			}
 
 			// If we didn't move, select the note under cursor
-			NoteLabel *child = qobject_cast<NoteLabel*>(childAt(event->pos()));
+			NoteLabel *child = noteAt(event->pos());
 			if (child && !m_actionHappened && !event->modifiers() && event->button() == Qt::LeftButton)
 				selectNote(child);
 		}
 		m_selectedAction = NONE;
 	}
+	m_actionNote = NULL;
+	m_resizeDir = 0;
+	m_dragHotSpot = QPoint();
 	m_actionHappened = false;
 	m_mouseHotSpot = QPoint();
 	m_seeking = false;
@@ -498,12 +518,17 @@ void NoteGraphWidget::wheelEvent(QWheelEvent *event)
 		event->accept();
 		return;
 	}
+	// Horizontal wheel scrolls (the scroll area only handles vertical scrolling)
+	if (m_scrollBar) {
+		QApplication::sendEvent(m_scrollBar, event);
+		return;
+	}
 	event->ignore();
 }
 
 void NoteGraphWidget::mouseDoubleClickEvent(QMouseEvent *event)
 {
-	NoteLabel *child = qobject_cast<NoteLabel*>(childAt(event->pos()));
+	NoteLabel *child = noteAt(event->pos());
 	if (!child) {
 		// Double click empty space = seek there
 		seek(event->x());
@@ -521,13 +546,22 @@ void NoteGraphWidget::mouseMoveEvent(QMouseEvent *event)
 		if (m_selectedAction != NONE && selectedNote()) {
 			m_actionHappened = true; // We have movement, so resize/move can be accepted
 			// Undo op is handled later by the MOVE constructed at drop
-			for (int i = 0; i < m_selectedNotes.size(); ++i)
-				m_selectedNotes[i]->setFloating(false);
+			for (int i = m_selection.first(); i >= 0; i = m_selection.next(i)) {
+				m_notes[i]->setFloating(false);
+				invalidateLayout(i, i);
+			}
 		}
 	}
 
+	// Resizing or moving notes
+	if (m_selectedAction == RESIZE && m_actionNote) {
+		resizeNote(event->pos());
+
+	} else if (m_selectedAction == MOVE && m_actionNote) {
+		dragNotes(event->pos());
+
 	// Seeking
-	if (m_seeking) {
+	} else if (m_seeking) {
 		seek(event->x());
 
 	// Box selection
@@ -538,14 +572,19 @@ void NoteGraphWidget::mouseMoveEvent(QMouseEvent *event)
 	// Pan
 	} else if (!m_mouseHotSpot.isNull()) {
 		setCursor(QCursor(Qt::ClosedHandCursor));
+		QPoint diff = event->pos() - m_mouseHotSpot;
+		// Horizontally the view scrolls under the widget, so the hot spot moves with the content
+		int offset = viewOffset();
+		setViewBegin(m_viewBegin - diff.x() / m_pixelsPerSecond);
+		m_mouseHotSpot.rx() -= viewOffset() - offset;
 		if (QScrollArea *scrollArea = getScrollArea()) {
-			QPoint diff = event->pos() - m_mouseHotSpot;
-			QScrollBar *scrollHor = scrollArea->horizontalScrollBar();
-			scrollHor->setValue(scrollHor->value() - diff.x());
 			QScrollBar *scrollVer = scrollArea->verticalScrollBar();
 			scrollVer->setValue(scrollVer->value() - diff.y());
-			m_mouseHotSpot = event->pos() - diff;
 		}
+
+	// Hover
+	} else {
+		updateCursor(event->pos());
 	}
 
 	MusicalScale ms;
@@ -557,6 +596,69 @@ void NoteGraphWidget::mouseMoveEvent(QMouseEvent *event)
 	emit updateNoteInfo(selectedNote());
 }
 
+void NoteGraphWidget::resizeNote(const QPoint &pos)
+{
+	Note &n = m_actionNote->note();
+	if (m_resizeDir < 0) n.begin = px2s(pos.x()); // Left side
+	else n.end = px2s(pos.x()); // Right side
+	// Enforce minimum size
+	if (n.length() < NoteLabel::min_length) {
+		if (m_resizeDir < 0) n.begin = n.end - NoteLabel::min_length; // Left side
+		else n.end = n.begin + NoteLabel::min_length; // Right side
+	}
+	int id = getNoteLabelId(m_actionNote);
+	invalidateLayout(id, id);
+	updateNotes(m_resizeDir > 0);
+	QToolTip::showText(mapToGlobal(pos), m_actionNote->description(true), this);
+}
+
+void NoteGraphWidget::dragNotes(const QPoint &pos)
+{
+	QPoint local = pos - noteRect(m_actionNote).topLeft();
+	QPoint newpos = noteRect(m_actionNote).topLeft() + local - m_dragHotSpot;
+	double ds = (local.x() - m_dragHotSpot.x()) / m_pixelsPerSecond;
+	int dn = px2n(local.y()) - px2n(m_dragHotSpot.y());
+	for (int i = m_selection.first(); i >= 0; i = m_selection.next(i)) {
+		Note &n = m_notes[i]->note();
+		n.begin += ds;
+		n.end += ds;
+		n.note += dn;
+		invalidateLayout(i, i);
+	}
+	updateNotes(local.x() - m_dragHotSpot.x() < 0);
+	// Check if we need a new hotspot, because the note was constrained
+	if (noteRect(m_actionNote).x() != newpos.x()) m_dragHotSpot = local;
+	QToolTip::showText(mapToGlobal(pos), m_actionNote->description(true), this);
+}
+
+void NoteGraphWidget::updateCursor(const QPoint &pos)
+{
+	NoteLabel *nl = noteAt(pos);
+	if (!nl) {
+		unsetCursor();
+		return;
+	}
+	QRect r = noteRect(nl);
+	if (pos.x() < r.left() + NoteLabel::resize_margin || pos.x() > r.right() - NoteLabel::resize_margin) {
+		setCursor(QCursor(Qt::SizeHorCursor));
+	} else {
+		setCursor(QCursor(Qt::OpenHandCursor));
+	}
+}
+
+bool NoteGraphWidget::event(QEvent *event)
+{
+	// Notes are not widgets, so their tooltips are shown here
+	if (event->type() == QEvent::ToolTip) {
+		QHelpEvent *helpEvent = static_cast<QHelpEvent*>(event);
+		NoteLabel *nl = noteAt(helpEvent->pos());
+		if (nl) QToolTip::showText(helpEvent->globalPos(), nl->description(true), this, noteRect(nl));
+		else QToolTip::hideText();
+		return true;
+	}
+	return NoteLabelManager::event(event);
+}
+
 void NoteGraphWidget::keyPressEvent(QKeyEvent *event)
 {
 	int k = event->key(), m = event->modifiers();
@@ -605,8 +707,8 @@ void NoteGraphWidget::dropEvent(QDropEvent *event)
 void NoteGraphWidget::showContextMenu(const QPoint &pos)
 {
 	QPoint globalPos = mapToGlobal(pos);
-	NoteLabel *child = qobject_cast<NoteLabel*>(childAt(mapFromGlobal(globalPos)));
-	if (child && !child->isSelected()) selectNote(child);
+	NoteLabel *child = noteAt(mapFromGlobal(globalPos));
+	if (child && !isSelected(child)) selectNote(child);
 	QMenu menuContext(NULL);
 	QMenu menuType(tr("Type"), NULL);
 
@@ -614,9 +716,9 @@ void NoteGraphWidget::showContextMenu(const QPoint &pos)
 	actionNew->setIcon(QIcon::fromTheme("insert-object", QIcon(":/icons/insert-object.png")));
 	actionNew->setEnabled(!child); // Only available when no notes under cursor
 	QAction *actionSplit = menuContext.addAction(tr("Split"));
-	actionSplit->setEnabled(m_selectedNotes.size() == 1); // Only available when exactly one note selected
+	actionSplit->setEnabled(m_selection.count() == 1); // Only available when exactly one note selected
 	QAction *actionLyric = menuContext.addAction(tr("Edit lyric"));
-	actionLyric->setEnabled(m_selectedNotes.size() == 1); // Only available when exactly one note selected
+	actionLyric->setEnabled(m_selection.count() == 1); // Only available when exactly one note selected
 	menuContext.addSeparator();
 
 	QAction *actionFloating = menuContext.addAction(tr("Floating"));
@@ -651,25 +753,25 @@ void NoteGraphWidget::showContextMenu(const QPoint &pos)
 
 	QAction *actionCut = menuContext.addAction(tr("Cut"));
 	actionCut->setIcon(QIcon::fromTheme("edit-cut", QIcon(":/icons/edit-cut.png")));
-	actionCut->setEnabled(!m_selectedNotes.isEmpty());
+	actionCut->setEnabled(!m_selection.empty());
 	QAction *actionCopy = menuContext.addAction(tr("Copy"));
 	actionCopy->setIcon(QIcon::fromTheme("edit-copy", QIcon(":/icons/edit-copy.png")));
-	actionCopy->setEnabled(!m_selectedNotes.isEmpty());
+	actionCopy->setEnabled(!m_selection.empty());
 	QAction *actionPaste = menuContext.addAction(tr("Paste"));
 	actionPaste->setIcon(QIcon::fromTheme("edit-paste", QIcon(":/icons/edit-paste.png")));
 	QAction *actionDelete = menuContext.addAction(tr("Delete"));
 	actionDelete->setIcon(QIcon::fromTheme("edit-delete", QIcon(":/icons/edit-delete.png")));
-	actionDelete->setEnabled(!m_selectedNotes.isEmpty());
+	actionDelete->setEnabled(!m_selection.empty());
 	menuContext.addSeparator();
 
 	QAction *actionSelectAll = menuContext.addAction(tr("Select all"));
 	actionSelectAll->setEnabled(!m_notes.isEmpty());
 	actionSelectAll->setIcon(QIcon::fromTheme("edit-select-all", QIcon(":/icons/edit-select-all.png")));
 	QAction *actionSelectAllAfter = menuContext.addAction(tr("Select all after"));
-	actionSelectAllAfter->setEnabled(!m_selectedNotes.isEmpty());
+	actionSelectAllAfter->setEnabled(!m_selection.empty());
 	actionSelectAllAfter->setIcon(QIcon::fromTheme("edit-select-all", QIcon(":/icons/edit-select-all.png")));
 	QAction *actionDeselect = menuContext.addAction(tr("Deselect"));
-	actionDeselect->setEnabled(!m_selectedNotes.isEmpty());
+	actionDeselect->setEnabled(!m_selection.empty());
 
 	QAction *sel = menuContext.exec(globalPos);
 	if (sel) {
@@ -723,9 +825,9 @@ QString NoteGraphWidget::getCurrentSentence() const
 		for (int i = id; i < m_notes.size(); ++i) {
 			if (i != id && m_notes[i]->note().lineBreak) break;
 			// Selected notes are highlighted with different color
-			if (m_notes[i]->isSelected()) lyrics += "<span style=\"color: #a00;\">";
+			if (m_selection.contains(i)) lyrics += "<span style=\"color: #a00;\">";
 			lyrics += m_notes[i]->lyric();
-			if (m_notes[i]->isSelected()) lyrics += "</span>";
+			if (m_selection.contains(i)) lyrics += "</span>";
 			lyrics += " ";
 		}
 		lyrics = lyrics.left(lyrics.size() - 1); // Remove trailing space
@@ -788,19 +890,6 @@ void SeekHandle::mouseMoveEvent(QMouseEvent *event)
 	event->ignore();
 }
 
-void SeekHandle::moveEvent(QMoveEvent*)
-{
-	// Make handle always visible in the ScrollArea
-	if (wrapToViewport && parentWidget() && parentWidget()->parentWidget()) {
-		QScrollArea *scrollArea = qobject_cast<QScrollArea*>(parentWidget()->parentWidget()->parent());
-		if (scrollArea) {
-			QScrollBar *scrollVer = scrollArea->verticalScrollBar();
-			int y = 0;
-			if (scrollVer) y = scrollVer->value();
-			scrollArea->ensureVisible(x() + scrollArea->width()/3, y, scrollArea->width()/3, 0);
-		}
-	}
-}
 
 
 
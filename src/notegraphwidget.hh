@@ -3,13 +3,19 @@
 #include "pitchvis.hh"
 #include "notes.hh"
 #include "operation.hh"
+#include "noteselection.hh"
+#include "noteindex.hh"
+#include "noterenderer.hh"
 #include <QLabel>
+#include <cmath>
 #include <QList>
 #include <QScopedPointer>
 #include <QElapsedTimer>
 
 class QScrollArea;
+class QScrollBar;
 class NoteLabel;
+struct FloatingGap;
 typedef QList<NoteLabel*> NoteLabels;
 
 
@@ -19,10 +25,9 @@ class SeekHandle: public QLabel
 public:
 	SeekHandle(QWidget *parent = 0);
 	int curx() const { return x() + width() / 2; }
-	bool wrapToViewport;
+	bool wrapToViewport;  ///< Scroll the note graph to keep the handle visible during playback
 protected:
 	void mouseMoveEvent(QMouseEvent *event);
-	void moveEvent(QMoveEvent *event);
 };
 
 
@@ -36,8 +41,6 @@ public:
 	NoteLabelManager(QWidget *parent = 0);
 
 	virtual void updateNotes(bool leftToRight = true) {}
-	virtual void startNotePixmapUpdates() {}
-	virtual void forcedNotePixmapUpdate() {}
 
 	void reset();
 	void clearNotes();
@@ -46,13 +49,19 @@ public:
 	void selectAllAfter();
 	void shiftSelect(NoteLabel *note);
 	void boxSelect(QPoint p1, QPoint p2);
-	NoteLabel* selectedNote() const { return m_selectedNotes.isEmpty() ? NULL : m_selectedNotes.front(); }
-	NoteLabels& selectedNotes() { return m_selectedNotes; }
-	NoteLabels const& selectedNotes() const { return m_selectedNotes; }
-
-	int getNoteLabelId(NoteLabel* note) const;
-	int findIdForTime(double time) const;
-	NoteLabels& noteLabels() { return m_notes; }
+	void selectRange(int first, int last, int primary);
+	NoteLabel* selectedNote() const { return m_selection.empty() ? NULL : m_notes[m_selection.primary()]; }
+	NoteLabels selectedNotes() const;  ///< Selected notes in time order
+	int selectedCount() const { return m_selection.count(); }
+	bool isSelected(const NoteLabel *note) const { return m_selection.contains(getNoteLabelId(note)); }
+
+	int getNoteLabelId(const NoteLabel* note) const;
+	int findIdForTime(double time) const; ///< First note beginning at or after time (binary search)
+	/// Ids of the notes whose rectangles intersect rect (in ascending order)
+	std::vector<int> findIdsInRect(const QRect &rect) const;
+	NoteLabels const& noteLabels() const { return m_notes; }
+	QRect noteRect(const NoteLabel *note) const;
+	NoteLabel* noteAt(const QPoint &pos) const;
 
 	void createNote(double time);
 	void split(NoteLabel *note, float ratio = 0.5f);
@@ -64,12 +73,23 @@ public:
 	void setType(NoteLabel *note, int newtype);
 
 	void doOperation(const Operation& op, int flags = Operation::NORMAL);
+	/// Start collecting operations: until commitBatch() they are executed without layout or signals
+	void beginBatch();
+	/// Lay out the notes once and emit the batched operations as one undo step (batches may be nested)
+	void commitBatch();
 
 	virtual void zoom(float steps, double focalSecs = -1);
 	int getZoomLevel() const;
 
-	int s2px(double sec) const;
-	double px2s(int px) const;
+	/// Horizontal scroll bar that controls the view (the widget itself is only as wide as its viewport)
+	void setHorizontalScrollBar(QScrollBar *scrollBar);
+	/// Time at the left edge of the widget
+	double viewBegin() const { return m_viewBegin; }
+	/// Scroll so that time sec is at the left edge (clamped to the song)
+	void setViewBegin(double sec);
+
+	int s2px(double sec) const;  ///< Time to x coordinate of the widget
+	double px2s(int px) const;  ///< x coordinate of the widget to time
 	int n2px(double note) const;
 	double px2n(int px) const;
 
@@ -78,6 +98,7 @@ public:
 signals:
 	void updateNoteInfo(NoteLabel*);
 	void operationDone(const Operation&);
+	void operationsDone(const QList<Operation>&);
 	void statusBarMessage(QString);
 
 public slots:
@@ -87,9 +108,23 @@ public slots:
 	void copy();
 	void paste();
 
+private slots:
+	void scrollBarMoved(int value);
+
 protected:
 	QScrollArea* getScrollArea() const;
 	void calcViewport(int &x1, int &y1, int &x2, int &y2) const;
+	/// Horizontal scroll position in pixels (from the song start) at the current zoom
+	int viewOffset() const { return std::floor(m_viewBegin * m_pixelsPerSecond + 0.5); }
+	/// Update the scroll range after the song length, zoom or widget width has changed
+	void updateScrollBar();
+	/// Called after the view has been scrolled horizontally
+	virtual void viewMoved() {}
+	void insertNote(int id, NoteLabel *note);
+	void removeNote(int id);
+	void invalidateLayout() { m_layoutDirection = 0; m_indexDirty = true; }  ///< Lay out all notes on the next updateNotes()
+	void invalidateLayout(int first, int last);  ///< Notes first..last were changed, lay out the gaps around them
+	void invalidateIndex(int first, int last);  ///< Notes first..last have moved, re-index them on the next hit test
 
 	// Zoom settings
 	static const double zoomStep;  ///< Mouse wheel steps * zoomStep => double/half zoom factor
@@ -97,9 +132,19 @@ protected:
 	static const int zoomMax = 6;  ///< Number of steps to maximum zoom
 	static const double ppsNormal;  ///< Pixels per second with default zoom
 	double m_pixelsPerSecond;
-
-	NoteLabels m_notes;
-	NoteLabels m_selectedNotes;
+	double m_viewBegin;  ///< Time at the left edge of the widget
+	QScrollBar *m_scrollBar;
+
+	NoteLabels m_notes;  ///< All notes, ordered by begin time (binary searched, kept in order by updateNotes)
+	mutable int m_firstDirtyId;  ///< Cached note ids from this position onwards need renumbering
+	int m_layoutDirection;  ///< Direction of the previous updateNotes() (1 = left to right, -1 = right to left, 0 = none)
+	int m_layoutDirtyBegin, m_layoutDirtyEnd;  ///< Range of notes changed since the previous updateNotes()
+	int m_batchDepth;  ///< Nesting level of beginBatch() calls
+	mutable NoteIndex m_index;  ///< Note rectangles for hit testing, updated on demand
+	mutable bool m_indexDirty;  ///< m_index must be rebuilt from scratch
+	mutable int m_indexDirtyBegin, m_indexDirtyEnd;  ///< Range of notes moved since m_index was updated
+	QList<Operation> m_batchOps;  ///< Operations to emit on commitBatch()
+	NoteSelection m_selection;  ///< Ids of the selected notes
 	enum NoteAction { NONE, RESIZE, MOVE } m_selectedAction;
 	int m_noteHalfHeight;
 	double m_songLengthInSeconds;
@@ -120,8 +165,9 @@ public:
 
 	void setLyrics(QString lyrics);
 	void setLyrics(const VocalTrack &track);
-	void analyzeMusic(QString filepath, int visId = 0);
+	void analyzeMusic(QString filepath, int visId = 0, PitchEngine::Type engine = PitchEngine::HARMONIC);
 
+	/// Lay out the floating notes into the gaps between the fixed ones (only around the notes changed since the last call)
 	void updateNotes(bool leftToRight = true);
 	void updateMusicPos(qint64 time, bool smoothing = true);
 	void stopMusic();
@@ -138,12 +184,10 @@ public slots:
 	void timeSyllable();
 	void timeSentence();
 	void setSeekHandleWrapToViewport(bool state) { m_seekHandle.wrapToViewport = state; }
-	void updatePixmap(const QImage &image, const QPoint &position, int visId);
+	void updatePixmap(const QImage &image, const QPoint &position, double pixelsPerSecond, int visId);
 	void updatePitch();
 	void abortPitch() { for (int i = 0; i < MaxPitchVis; ++i) if (m_pitch[i]) m_pitch[i]->cancel(); }
 	void scrollToFirstNote();
-	void startNotePixmapUpdates(); ///< Starts creating pixmaps for NoteLabels
-	void forcedNotePixmapUpdate();
 	void playbackRateChanged(qreal rate);
 
 signals:
@@ -159,22 +203,30 @@ protected:
 	void mouseMoveEvent(QMouseEvent * event);
 	void keyPressEvent(QKeyEvent *event);
 	void timerEvent(QTimerEvent *event);
-	void paintEvent(QPaintEvent*);
-	void resizeEvent(QResizeEvent *) { updatePitch(); }
+	void paintEvent(QPaintEvent *event);
+	bool event(QEvent *event);
+	void resizeEvent(QResizeEvent *) { updateScrollBar(); updatePitch(); }
+	void viewMoved() { moveSeekHandle(); updatePitch(); }
 	void dragEnterEvent(QDragEnterEvent *event);
 	void dropEvent(QDropEvent *event);
 
 private:
 	void finalizeNewLyrics();
 	void timeCurrent();
+	void resizeNote(const QPoint &pos);
+	void dragNotes(const QPoint &pos);
+	bool layoutGap(FloatingGap &gap, Note &n, bool leftToRight);  ///< Returns true if the fixed note n was pushed aside
+	void updateCursor(const QPoint &pos);
+	void moveSeekHandle();
 
 	QPoint m_mouseHotSpot;
+	NoteLabel *m_actionNote; ///< The note being resized or dragged
+	int m_resizeDir; ///< -1 = left edge, 1 = right edge
+	QPoint m_dragHotSpot; ///< Drag position relative to the note being dragged
 	bool m_seeking;
 	bool m_actionHappened;
 	QScopedPointer<PitchVis> m_pitch[MaxPitchVis];
 	SeekHandle m_seekHandle;
-	int m_nextNotePixmap;
-	int m_notePixmapTimer;
 	int m_analyzeTimer;
 	int m_playbackTimer;
 	QElapsedTimer m_playbackInterval;
@@ -182,6 +234,8 @@ private:
 	qreal m_playbackRate;
 	QPixmap m_pixmap[MaxPitchVis];
 	QPoint m_pixmapPos[MaxPitchVis];
+	double m_pixmapScale[MaxPitchVis];  ///< Pixels per second the pitch pixmaps were rendered at
+	NoteRenderer m_renderer;
 };
 
 
@@ -0,0 +1,129 @@
+#include "noteindex.hh"
+#include "notelabel.hh"
+#include <algorithm>
+
+void NoteIndex::build(const NoteLabels &notes)
+{
+	clear();
+	m_nodes.reserve(notes.size());
+	for (int i = 0; i < notes.size(); ++i) insert(notes[i]);
+}
+
+void NoteIndex::update(const NoteLabels &notes, int first, int last)
+{
+	for (int i = first; i <= last; ++i) {
+		remove(notes[i]);
+		insert(notes[i]);
+	}
+}
+
+void NoteIndex::remove(const NoteLabel *note)
+{
+	std::unordered_map<const NoteLabel*, Position>::iterator pit = m_positions.find(note);
+	if (pit == m_positions.end()) return;
+	std::map<int, int>::iterator rit = m_rows.find(pit->second.row);
+	Entry e = { pit->second.begin, 0.0, note };
+	erase(rit->second, e);
+	if (rit->second < 0) m_rows.erase(rit);
+	m_positions.erase(pit);
+}
+
+void NoteIndex::insert(const NoteLabel *note)
+{
+	const Note &n = note->note();
+	int node;
+	if (m_free.empty()) {
+		node = m_nodes.size();
+		m_nodes.push_back(Node());
+	} else {
+		node = m_free.back();
+		m_free.pop_back();
+	}
+	Entry e = { n.begin, n.end, note };
+	Node &nd = m_nodes[node];
+	nd.entry = e;
+	nd.priority = m_random();
+	nd.maxEnd = n.end;
+	nd.left = nd.right = -1;
+	std::map<int, int>::iterator rit = m_rows.insert(std::make_pair(n.note, -1)).first;
+	insert(rit->second, node);
+	Position p = { n.note, n.begin };
+	m_positions[note] = p;
+}
+
+void NoteIndex::pull(int node)
+{
+	Node &nd = m_nodes[node];
+	nd.maxEnd = nd.entry.end;
+	if (nd.left >= 0) nd.maxEnd = std::max(nd.maxEnd, m_nodes[nd.left].maxEnd);
+	if (nd.right >= 0) nd.maxEnd = std::max(nd.maxEnd, m_nodes[nd.right].maxEnd);
+}
+
+void NoteIndex::split(int tree, const Entry &e, int &before, int &after)
+{
+	if (tree < 0) { before = after = -1; return; }
+	Node &nd = m_nodes[tree];
+	if (lessThan(nd.entry, e)) {
+		split(nd.right, e, nd.right, after);
+		before = tree;
+	} else {
+		split(nd.left, e, before, nd.left);
+		after = tree;
+	}
+	pull(tree);
+}
+
+void NoteIndex::insert(int &tree, int node)
+{
+	if (tree < 0) { tree = node; return; }
+	Node &nd = m_nodes[tree];
+	if (m_nodes[node].priority > nd.priority) {
+		// The new node becomes the root of this subtree
+		split(tree, m_nodes[node].entry, m_nodes[node].left, m_nodes[node].right);
+		tree = node;
+	} else insert(lessThan(m_nodes[node].entry, nd.entry) ? nd.left : nd.right, node);
+	pull(tree);
+}
+
+int NoteIndex::merge(int before, int after)
+{
+	if (before < 0) return after;
+	if (after < 0) return before;
+	if (m_nodes[before].priority > m_nodes[after].priority) {
+		m_nodes[before].right = merge(m_nodes[before].right, after);
+		pull(before);
+		return before;
+	}
+	m_nodes[after].left = merge(before, m_nodes[after].left);
+	pull(after);
+	return after;
+}
+
+void NoteIndex::erase(int &tree, const Entry &e)
+{
+	Node &nd = m_nodes[tree];
+	if (nd.entry.note == e.note) {
+		m_free.push_back(tree);
+		tree = merge(nd.left, nd.right);
+		return;
+	}
+	erase(lessThan(e, nd.entry) ? nd.left : nd.right, e);
+	pull(tree);
+}
+
+void NoteIndex::find(int tree, double begin, double end, std::vector<const NoteLabel*> &found) const
+{
+	if (tree < 0) return;
+	const Node &nd = m_nodes[tree];
+	if (nd.maxEnd < begin) return;  // Everything in the subtree ends before the range
+	find(nd.left, begin, end, found);
+	if (nd.entry.begin > end) return;  // This and the later ones begin after the range
+	if (nd.entry.end >= begin) found.push_back(nd.entry.note);
+	find(nd.right, begin, end, found);
+}
+
+void NoteIndex::find(double begin, double end, int low, int high, std::vector<const NoteLabel*> &found) const
+{
+	for (std::map<int, int>::const_iterator it = m_rows.lower_bound(low); it != m_rows.end() && it->first <= high; ++it)
+		find(it->second, begin, end, found);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include <QList>
+
+class NoteLabel;
+typedef QList<NoteLabel*> NoteLabels;
+
+/**
+ * @brief Index of the note extents (time interval x pitch row) for hit testing.
+ *
+ * Each pitch row is an interval tree: a treap ordered by begin time where every
+ * node also keeps the maximum end time of its subtree. Subtrees that end before
+ * the range or begin after it are skipped, so both the queries and the updates
+ * of individual notes take logarithmic time.
+ */
+class NoteIndex
+{
+public:
+	/// Rebuild the index from notes ordered by begin time
+	void build(const NoteLabels &notes);
+	/// Re-index notes[first..last] after their extents changed (or they were added)
+	void update(const NoteLabels &notes, int first, int last);
+	/// Drop note from the index (before deleting it)
+	void remove(const NoteLabel *note);
+	void clear() { m_nodes.clear(); m_free.clear(); m_rows.clear(); m_positions.clear(); }
+	/// Append the notes on pitch rows low..high overlapping [begin, end] to found
+	void find(double begin, double end, int low, int high, std::vector<const NoteLabel*> &found) const;
+
+private:
+	struct Entry {
+		double begin, end;
+		const NoteLabel *note;
+	};
+	/// Tree order: by begin, then by note so that every entry has a unique place
+	static bool lessThan(const Entry &a, const Entry &b) {
+		return a.begin < b.begin || (a.begin == b.begin && std::less<const NoteLabel*>()(a.note, b.note));
+	}
+	struct Node {
+		Entry entry;
+		unsigned priority;  ///< Heap order of the treap (random, keeps it balanced)
+		double maxEnd;  ///< Maximum end in the subtree
+		int left, right;  ///< Children (indices into m_nodes, -1 for none)
+	};
+	/// Where a note is indexed
+	struct Position {
+		int row;
+		double begin;
+	};
+	void insert(const NoteLabel *note);
+	/// Recalculate the maxEnd of node from its children
+	void pull(int node);
+	/// Split tree into the nodes before e and the others
+	void split(int tree, const Entry &e, int &before, int &after);
+	/// Join two trees where all of before precede all of after, returns the root
+	int merge(int before, int after);
+	/// Add node to tree
+	void insert(int &tree, int node);
+	/// Remove the node of e from tree (e must be in it)
+	void erase(int &tree, const Entry &e);
+	void find(int tree, double begin, double end, std::vector<const NoteLabel*> &found) const;
+	std::vector<Node> m_nodes;  ///< Nodes of all rows
+	std::vector<int> m_free;  ///< Unused nodes in m_nodes
+	std::map<int, int> m_rows;  ///< Root node of each pitch row
+	std::unordered_map<const NoteLabel*, Position> m_positions;
+	std::minstd_rand m_random;  ///< Node priorities
+};
@@ -1,4 +1,6 @@
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 #include <QString>
 #include <QInputDialog>
 #include <QLineEdit>
@@ -13,73 +15,81 @@
 #include "operation.hh"
 
 
-/*static*/ const QString NoteLabelManager::MimeType = "application/x-notelabels";
+/*static*/ const QString NoteLabelManager::MimeType = "application/x-notelabels-v2";
 //to silence the MSVC compiler
 /*static*/ const double NoteLabelManager::zoomStep = 0.5;
 /*static*/ const double NoteLabelManager::ppsNormal = 200.0;
 
 
 NoteLabelManager::NoteLabelManager(QWidget *parent)
-	: QLabel(parent), m_selectedAction(NONE), m_pixelsPerSecond(ppsNormal), m_songLengthInSeconds(10.0)
+	: QLabel(parent), m_pixelsPerSecond(ppsNormal), m_viewBegin(), m_scrollBar(), m_firstDirtyId(),
+	m_layoutDirection(), m_layoutDirtyBegin(), m_layoutDirtyEnd(), m_batchDepth(), m_indexDirty(true), m_indexDirtyBegin(), m_indexDirtyEnd(), m_selectedAction(NONE), m_songLengthInSeconds(10.0)
 {
-	// Determine NoteLabel height
-	NoteLabel templabel(Note(" "), NULL);
-	m_noteHalfHeight = templabel.height()/2;
-	templabel.close();
+	m_noteHalfHeight = NoteLabel::height()/2;
 }
 
 void NoteLabelManager::reset()
 {
 	m_songLengthInSeconds = 10;
+	invalidateLayout();
+	updateScrollBar();
 }
 
 void NoteLabelManager::clearNotes()
 {
 	selectNote(NULL);
 	// Clear NoteLabels
-	const QObjectList &childlist = children();
-	for (QObjectList::const_iterator it = childlist.begin(); it != childlist.end(); ++it) {
-		NoteLabel *child = qobject_cast<NoteLabel*>(*it);
-		if (child) child->close();
-	}
+	qDeleteAll(m_notes);
 	m_notes.clear();
+	m_firstDirtyId = 0;
+	invalidateLayout();
+	update();
 }
 
 void NoteLabelManager::selectNote(NoteLabel* note, bool clearPrevious)
 {
 	// Clear all previous selections?
-	if (!note || clearPrevious) { // NULL means allways clear all
-		for (int i = 0; i < m_selectedNotes.size(); ++i)
-			m_selectedNotes[i]->setSelected(false);
-		m_selectedNotes.clear();
-	}
+	if (!note || clearPrevious) // NULL means allways clear all
+		m_selection.clear();
 
-	// Add at the beginning of the chain
-	if (note && !note->isSelected()) {
-		m_selectedNotes.push_front(note);
-		note->setSelected(true);
-	} else if (!note) m_selectedAction = NONE;
+	if (note) m_selection.select(getNoteLabelId(note));
+	else m_selectedAction = NONE;
+	update();
+
+	// Signal UI about the change (batches signal when committed)
+	if (!m_batchDepth) emit updateNoteInfo(selectedNote());
+}
 
-	// Signal UI about the change
+void NoteLabelManager::selectRange(int first, int last, int primary)
+{
+	m_selection.clear();
+	m_selection.selectRange(first, last);
+	m_selection.setPrimary(primary);
+	update();
 	emit updateNoteInfo(selectedNote());
 }
 
+NoteLabels NoteLabelManager::selectedNotes() const
+{
+	NoteLabels notes;
+	notes.reserve(m_selection.count());
+	for (int i = m_selection.first(); i >= 0; i = m_selection.next(i))
+		notes.push_back(m_notes[i]);
+	return notes;
+}
+
 void NoteLabelManager::selectAll()
 {
-	selectNote(NULL); // Clear previous
-	for (int i = m_notes.size()-1; i >= 0; --i) // Traverse in reverse order to get the first note first
-		selectNote(m_notes[i], false);
+	if (m_notes.isEmpty()) return;
+	selectRange(0, m_notes.size() - 1, 0);
 }
 
 void NoteLabelManager::selectAllAfter()
 {
-	if (m_selectedNotes.empty()) return;
-	NoteLabel* first = m_selectedNotes.back();
-	selectNote(NULL); // Clear previous
-	for (int i = m_notes.size()-1; i >= 0; --i) { // Traverse in reverse order to get the first note first
-		selectNote(m_notes[i], false);
-		if (m_notes[i] == first) break;
-	}
+	// Everything from the first selected note on
+	int first = m_selection.first();
+	if (first < 0) return;
+	selectRange(first, m_notes.size() - 1, first);
 }
 
 void NoteLabelManager::shiftSelect(NoteLabel* note)
@@ -89,10 +99,7 @@ void NoteLabelManager::shiftSelect(NoteLabel* note)
 
 	// Select all notes between the last selection and this
 	int n = getNoteLabelId(selectedNote()), m = getNoteLabelId(note);
-	selectNote(NULL); // Unselect everything
-	if (m < n) std::swap(n, m);
-	for (int i = n; i <= m; ++i)
-		selectNote(m_notes[i], false);
+	selectRange(std::min(n, m), std::max(n, m), m);
 }
 
 void NoteLabelManager::boxSelect(QPoint p1, QPoint p2)
@@ -101,31 +108,128 @@ void NoteLabelManager::boxSelect(QPoint p1, QPoint p2)
 	if (p1.x() > p2.x()) std::swap(p1.rx(), p2.rx());
 	if (p1.y() > p2.y()) std::swap(p1.ry(), p2.ry());
 	// Deselect all
-	selectNote(NULL);
-	// Loop through notes, select the ones inside rectangle
-	for (int i = 0; i < m_notes.size(); ++i) {
-		NoteLabel *nl = m_notes[i];
-		if (nl->x() > p2.x()) break;
-		if (nl->x() + nl->width() > p1.x()
-			&& nl->y() + nl->height() > p1.y()
-			&& nl->y() < p2.y())
-				selectNote(nl, false);
+	m_selection.clear();
+	m_selectedAction = NONE;
+	// Select the notes inside rectangle
+	std::vector<int> ids = findIdsInRect(QRect(p1, p2));
+	for (std::size_t i = 0; i < ids.size(); ++i)
+		m_selection.select(ids[i]);
+	update();
+	emit updateNoteInfo(selectedNote());
+}
+
+int NoteLabelManager::getNoteLabelId(const NoteLabel* note) const
+{
+	if (!note) return -1;
+	// Insertions and removals only mark the ids after them stale, renumber those on demand
+	if (note->m_id < 0 || note->m_id >= m_firstDirtyId) {
+		for (int i = m_firstDirtyId; i < m_notes.size(); ++i)
+			m_notes[i]->m_id = i;
+		m_firstDirtyId = m_notes.size();
 	}
+	int id = note->m_id;
+	if (id < 0 || id >= m_notes.size() || m_notes[id] != note) return -1;
+	return id;
 }
 
-int NoteLabelManager::getNoteLabelId(NoteLabel* note) const
+void NoteLabelManager::insertNote(int id, NoteLabel *note)
 {
-	for (int i = 0; i < m_notes.size(); ++i)
-		if (m_notes[i] == note) return i;
-	return -1;
+	if (id < 0 || id > m_notes.size()) id = m_notes.size();
+	bool append = (id == m_notes.size() && m_firstDirtyId == id);
+	m_notes.insert(id, note);
+	note->m_id = id;
+	// Appending keeps all ids valid, otherwise everything after the new note moved
+	m_firstDirtyId = append ? m_notes.size() : std::min(m_firstDirtyId, id + 1);
+	m_selection.insert(id);
+	// Shift the pending layout and index ranges past the new note
+	if (m_layoutDirtyBegin >= id) ++m_layoutDirtyBegin;
+	if (m_layoutDirtyEnd > id) ++m_layoutDirtyEnd;
+	if (m_indexDirtyBegin >= id) ++m_indexDirtyBegin;
+	if (m_indexDirtyEnd > id) ++m_indexDirtyEnd;
+	invalidateLayout(id, id);
+}
+
+void NoteLabelManager::removeNote(int id)
+{
+	m_index.remove(m_notes[id]);
+	m_notes.removeAt(id);
+	m_firstDirtyId = std::min(m_firstDirtyId, id);
+	m_selection.remove(id);
+	if (m_layoutDirtyBegin > id) --m_layoutDirtyBegin;
+	if (m_layoutDirtyEnd > id) --m_layoutDirtyEnd;
+	if (m_indexDirtyBegin > id) --m_indexDirtyBegin;
+	if (m_indexDirtyEnd > id) --m_indexDirtyEnd;
+	// The neighbours now share a gap
+	if (!m_notes.isEmpty())
+		invalidateLayout(std::max(id - 1, 0), std::min(id, m_notes.size() - 1));
+}
+
+namespace {
+	/// Extend the range begin..end (exclusive, empty if begin >= end) to cover first..last
+	void extendRange(int &begin, int &end, int first, int last) {
+		if (begin >= end) {
+			begin = first;
+			end = last + 1;
+		} else {
+			begin = std::min(begin, first);
+			end = std::max(end, last + 1);
+		}
+	}
+}
+
+void NoteLabelManager::invalidateLayout(int first, int last)
+{
+	invalidateIndex(first, last);
+	extendRange(m_layoutDirtyBegin, m_layoutDirtyEnd, first, last);
+}
+
+void NoteLabelManager::invalidateIndex(int first, int last)
+{
+	extendRange(m_indexDirtyBegin, m_indexDirtyEnd, first, last);
+}
+
+namespace {
+	bool noteBeginLessThan(const NoteLabel *nl, double time) { return nl->note().begin < time; }
 }
 
 int NoteLabelManager::findIdForTime(double time) const
 {
-	for (int i = 0; i < m_notes.size(); ++i) {
-		if (m_notes[i]->note().begin >= time) return i;
+	// m_notes is ordered by time (updateNotes() keeps it that way)
+	return std::lower_bound(m_notes.begin(), m_notes.end(), time, noteBeginLessThan) - m_notes.begin();
+}
+
+std::vector<int> NoteLabelManager::findIdsInRect(const QRect &rect) const
+{
+	if (m_indexDirty) {
+		m_index.build(m_notes);
+		m_indexDirty = false;
+	} else if (m_indexDirtyBegin < m_indexDirtyEnd) {
+		// Only the moved notes (e.g. the ones being dragged and the floating ones around them)
+		m_index.update(m_notes, std::max(m_indexDirtyBegin, 0), std::min(m_indexDirtyEnd, m_notes.size()) - 1);
 	}
-	return m_notes.size();
+	m_indexDirtyBegin = m_indexDirtyEnd = 0;
+	// Candidates by time and pitch row (with a pixel of margin), then the exact test
+	std::vector<const NoteLabel*> found;
+	m_index.find(px2s(rect.left() - 1), px2s(rect.right() + 1),
+		std::floor(px2n(rect.bottom() + m_noteHalfHeight + 1)), std::ceil(px2n(rect.top() - m_noteHalfHeight - 1)), found);
+	std::vector<int> ids;
+	for (std::vector<const NoteLabel*>::const_iterator it = found.begin(); it != found.end(); ++it)
+		if (noteRect(*it).intersects(rect)) ids.push_back(getNoteLabelId(*it));
+	std::sort(ids.begin(), ids.end());
+	return ids;
+}
+
+QRect NoteLabelManager::noteRect(const NoteLabel *note) const
+{
+	const Note &n = note->note();
+	int x = s2px(n.begin);
+	return QRect(x, n2px(n.note) - m_noteHalfHeight, s2px(n.end) - x, 2 * m_noteHalfHeight);
+}
+
+NoteLabel* NoteLabelManager::noteAt(const QPoint &pos) const
+{
+	std::vector<int> ids = findIdsInRect(QRect(pos, QSize(1, 1)));
+	return ids.empty() ? NULL : m_notes[ids.front()];
 }
 
 void NoteLabelManager::selectNextSyllable(bool backwards, bool addToSelection)
@@ -156,16 +260,51 @@ QScrollArea* NoteLabelManager::getScrollArea() const
 
 void NoteLabelManager::calcViewport(int &x1, int &y1, int &x2, int &y2) const
 {
+	// Horizontally the widget is the viewport, vertically it scrolls normally
 	QScrollArea *scrollArea = getScrollArea();
-	x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+	x1 = 0, x2 = width(), y1 = 0, y2 = height();
 	if (scrollArea) {
-		if (scrollArea->horizontalScrollBar())
-			x1 = scrollArea->horizontalScrollBar()->value();
-		x2 = x1 + scrollArea->width();
 		if (scrollArea->verticalScrollBar())
 			y1 = scrollArea->verticalScrollBar()->value();
-		y2 = y1 + scrollArea->height();
+		y2 = y1 + scrollArea->viewport()->height();
+	}
+}
+
+void NoteLabelManager::setHorizontalScrollBar(QScrollBar *scrollBar)
+{
+	if (m_scrollBar) disconnect(m_scrollBar, 0, this, 0);
+	m_scrollBar = scrollBar;
+	if (m_scrollBar) connect(m_scrollBar, SIGNAL(valueChanged(int)), this, SLOT(scrollBarMoved(int)));
+	updateScrollBar();
+}
+
+void NoteLabelManager::updateScrollBar()
+{
+	setViewBegin(m_viewBegin); // Clamp to the new limits
+	if (!m_scrollBar) return;
+	const QSignalBlocker blocker(m_scrollBar);
+	m_scrollBar->setRange(0, std::max(0, int(std::floor(m_songLengthInSeconds * m_pixelsPerSecond)) - width()));
+	m_scrollBar->setPageStep(width());
+	m_scrollBar->setSingleStep(std::max(1, width() / 20));
+	m_scrollBar->setValue(viewOffset());
+}
+
+void NoteLabelManager::setViewBegin(double sec)
+{
+	sec = std::max(0.0, std::min(sec, m_songLengthInSeconds - width() / m_pixelsPerSecond));
+	if (sec == m_viewBegin) return;
+	m_viewBegin = sec;
+	if (m_scrollBar) {
+		const QSignalBlocker blocker(m_scrollBar);
+		m_scrollBar->setValue(viewOffset());
 	}
+	viewMoved();
+	update();
+}
+
+void NoteLabelManager::scrollBarMoved(int value)
+{
+	if (value != viewOffset()) setViewBegin(value / m_pixelsPerSecond);
 }
 
 
@@ -182,25 +321,22 @@ void NoteLabelManager::createNote(double time)
 		int nlvl = (id > 0) ? m_notes[id-1]->note().note : 24;
 
 		QTextStream ts(&text, QIODevice::ReadOnly);
+		beginBatch();
 		// Loop through all words
 		while (!ts.atEnd()) {
 			QString word;
 			ts >> word;
 			if (!word.isEmpty()) {
 				// Create Operation for each word
-				Operation op("NEW");
-				op << id << word
-					<< time // begin
-					<< time+1 // dummy end
-					<< nlvl // note
-					<< true // floating
-					<< false // linebreak
-					<< 0; // type
-				doOperation(op); // Execute operation
+				Note n(word);
+				n.begin = time;
+				n.end = time + 1; // dummy end
+				n.note = nlvl;
+				doOperation(Operation::newNote(id, n, true)); // Execute operation
 				++id;
 			}
 		}
-		forcedNotePixmapUpdate();
+		commitBatch();
 	}
 }
 
@@ -220,14 +356,16 @@ void NoteLabelManager::split(NoteLabel *note, float ratio)
 
 	// Create operations for adding the new labels and deleting the old one
 	int id = getNoteLabelId(note);
-	Operation new1("NEW"), new2("NEW");
-	new1 << id << firstst << n.begin << n.begin + n.length() * ratio << n.note << note->isFloating() << n.lineBreak << n.getTypeInt();
-	new2 << id+1 << secondst << n.begin + n.length() * ratio << n.end << n.note << note->isFloating() << false << 0;
-	doOperation(new1, Operation::NO_UPDATE);
-	doOperation(new2, Operation::NO_UPDATE);
-	doOperation(Operation("DEL", id+2), Operation::NO_UPDATE);
-	doOperation(Operation("COMBINER", 3)); // This will combine the previous ones to one undo action
-	forcedNotePixmapUpdate();
+	Note n1 = n, n2(secondst);
+	n1.syllable = firstst;
+	n1.end = n2.begin = n.begin + n.length() * ratio;
+	n2.end = n.end;
+	n2.note = n.note;
+	beginBatch();
+	doOperation(Operation::newNote(id, n1, note->isFloating()));
+	doOperation(Operation::newNote(id+1, n2, note->isFloating()));
+	doOperation(Operation(Operation::DEL, id+2));
+	commitBatch(); // This will combine the operations to one undo action
 }
 
 void NoteLabelManager::del(NoteLabel *note)
@@ -235,23 +373,21 @@ void NoteLabelManager::del(NoteLabel *note)
 	if (!note) return;
 
 	// If delete is directed to a selected note, all selected notes will be deleted
-	if (note->isSelected()) {
-		int i = 0; // We need this after the loop
-		for (; i < m_selectedNotes.size(); ++i) {
-			Operation op("DEL");
-			op << getNoteLabelId(m_selectedNotes[i]);
-			doOperation(op);
-		}
-		// Combine to one undo operation
-		if (i > 1) {
-			doOperation(Operation("COMBINER", i));
-		}
+	if (isSelected(note)) {
+		// Delete from the end so that the ids of the remaining notes stay valid
+		QList<int> ids;
+		for (int i = m_selection.first(); i >= 0; i = m_selection.next(i))
+			ids.push_front(i);
+		beginBatch();
+		for (int i = 0; i < ids.size(); ++i)
+			doOperation(Operation(Operation::DEL, ids[i]));
+		commitBatch();
 		// Clear all
-		m_selectedNotes.clear();
+		selectNote(NULL);
 
 	} else {
 		// Here we have non-selected note up for deletion
-		doOperation(Operation("DEL", getNoteLabelId(note)));
+		doOperation(Operation(Operation::DEL, getNoteLabelId(note)));
 	}
 }
 
@@ -259,77 +395,62 @@ void NoteLabelManager::move(NoteLabel *note, int value)
 {
 	if (!note) return;
 
-	int i = 0; // We need this after the loop
-	for (; i < m_selectedNotes.size(); ++i) {
-		const Note &n = m_selectedNotes[i]->note();
-		Operation op("MOVE");
-		op << getNoteLabelId(m_selectedNotes[i]) << n.begin << n.end << n.note + value;
-		doOperation(op, Operation::NO_UPDATE);
+	beginBatch();
+	for (int i = m_selection.first(); i >= 0; i = m_selection.next(i)) {
+		const Note &n = m_notes[i]->note();
+		doOperation(Operation::move(i, n.begin, n.end, n.note + value));
 	}
-
-	// Combine to one undo operation
-	if (i > 1) {
-		doOperation(Operation("COMBINER", i), Operation::NO_UPDATE);
-	}
-
-	updateNotes();
+	commitBatch();
 }
 
 void NoteLabelManager::setType(NoteLabel *note, int index)
 {
 	if (!note) return;
 	// Easy case: only one note
-	if (m_selectedNotes.size() == 1 || !note->isSelected()) {
+	if (m_selection.count() == 1 || !isSelected(note)) {
 		if (note->note().getTypeInt() == index) return;
-		Operation op("TYPE");
-		op << getNoteLabelId(note) << index;
-		doOperation(op, Operation::NO_UPDATE);
+		doOperation(Operation::setType(getNoteLabelId(note), index), Operation::NO_UPDATE);
 		return;
 	}
 
 	// Multiple notes selected: apply to all
-	int i = 0;
-	for (; i < m_selectedNotes.size(); ++i) {
-		Operation op("TYPE");
-		op << getNoteLabelId(m_selectedNotes[i]) << index;
-		doOperation(op, Operation::NO_UPDATE);
-	}
-	doOperation(Operation("COMBINER", i), Operation::NO_UPDATE);
+	beginBatch();
+	for (int i = m_selection.first(); i >= 0; i = m_selection.next(i))
+		doOperation(Operation::setType(i, index), Operation::NO_UPDATE);
+	commitBatch();
 }
 
 void NoteLabelManager::setFloating(NoteLabel *note, bool state)
 {
 	if (!note) return;
 	// Easy case: only one note
-	if (m_selectedNotes.size() == 1 || !note->isSelected()) {
+	if (m_selection.count() == 1 || !isSelected(note)) {
 		if (note->isFloating() == state) return;
-		doOperation(Operation("FLOATING", getNoteLabelId(note), state));
+		doOperation(Operation(Operation::FLOATING, getNoteLabelId(note), state));
 		return;
 	}
 
 	// Multiple notes selected: apply to all
-	int i = 0;
-	for (; i < m_selectedNotes.size(); ++i) {
-		doOperation(Operation("FLOATING", getNoteLabelId(m_selectedNotes[i]), state), Operation::NO_UPDATE);
-	}
-	doOperation(Operation("COMBINER", i));
+	beginBatch();
+	for (int i = m_selection.first(); i >= 0; i = m_selection.next(i))
+		doOperation(Operation(Operation::FLOATING, i, state));
+	commitBatch();
 }
 
 void NoteLabelManager::setLineBreak(NoteLabel *note, bool state)
 {
 	if (!note) return;
 	// Easy case: only one note
-	if (m_selectedNotes.size() == 1 || !note->isSelected()) {
+	if (m_selection.count() == 1 || !isSelected(note)) {
 		if (note->isLineBreak() == state) return;
-		doOperation(Operation("LINEBREAK", getNoteLabelId(note), state), Operation::NO_UPDATE);
+		doOperation(Operation(Operation::LINEBREAK, getNoteLabelId(note), state), Operation::NO_UPDATE);
 	}
 
 	// Multiple notes selected: apply to all
-	int i = 0;
-	for (; i < m_selectedNotes.size(); ++i) {
-		doOperation(Operation("LINEBREAK", getNoteLabelId(m_selectedNotes[i]), state), Operation::NO_UPDATE);
-	}
-	doOperation(Operation("COMBINER", i), Operation::NO_UPDATE);
+	beginBatch();
+	for (int i = m_selection.first(); i >= 0; i = m_selection.next(i))
+		doOperation(Operation(Operation::LINEBREAK, i, state), Operation::NO_UPDATE);
+	commitBatch();
 }
 
 void NoteLabelManager::editLyric(NoteLabel *note) {
@@ -342,10 +463,9 @@ void NoteLabelManager::editLyric(NoteLabel *note) {
 										note->lyric(), &ok);
 	if (ok && !text.isEmpty()) {
 		note->setLyric(text);
+		update();
 		// Create undo operation
-		Operation op("LYRIC");
-		op << getNoteLabelId(note) << text;
-		doOperation(op, Operation::NO_EXEC | Operation::NO_UPDATE);
+		doOperation(Operation::setLyric(getNoteLabelId(note), text), Operation::NO_EXEC | Operation::NO_UPDATE);
 	}
 }
 
@@ -354,82 +474,102 @@ void NoteLabelManager::doOperation(const Operation& op, int flags)
 {
 	if (!(flags & Operation::NO_EXEC)) {
 		try {
-			QString action = op.op();
-			if (action == "BLOCK" || action == "COMBINER") {
-				; // No op
-			} else if (action == "CLEAR") {
+			switch (op.type) {
+			case Operation::BLOCK:
+			case Operation::COMBINER:
+				break; // No op
+			case Operation::CLEAR:
 				clearNotes();
-			} else if (action == "NEW") {
-				Note newnote(op.s(2)); // lyric
-				newnote.begin = op.d(3); // begin
-				newnote.end = op.d(4); // end
-				newnote.note = op.i(5); // note
-				newnote.lineBreak = op.b(7); // lineBreak
-				newnote.type = Note::types[op.i(8)]; // note type
-				NoteLabel *newLabel = new NoteLabel(
-					newnote, // Note(lyric)
-					this, // parent
-					op.b(6) // floating
-					);
-				int id = op.i(1);
-				if (id < 0) id = findIdForTime(op.d(3)); // -1 = auto-choose
-				if (m_notes.isEmpty() || id > m_notes.size()) m_notes.push_back(newLabel);
-				else m_notes.insert(id, newLabel);
+				break;
+			case Operation::NEW: {
+				NoteLabel *newLabel = new NoteLabel(op.toNote(), op.state);
+				int id = op.id;
+				if (id < 0) id = findIdForTime(op.begin); // -1 = auto-choose
+				insertNote(id, newLabel);
 				if (flags & Operation::SELECT_NEW) selectNote(newLabel, false);
-			} else {
-				NoteLabel *n = m_notes.at(op.i(1));
-				if (n) {
-					if (action == "DEL") {
-						n->close();
-						m_notes.removeAt(op.i(1));
-					} else if (action == "MOVE") {
-						if(op.i(1) > 0) {
-							NoteLabel *previous = m_notes.at(op.i(1) -1);
-							if(previous && previous->note().end > op.d(2)) {
-								previous->note().end = op.d(2);
-								if(previous->note().begin >= previous->note().end) previous->note().begin = previous->note().end -0.01;
-							}
+				break;
+			}
+			case Operation::DEL:
+			case Operation::MOVE:
+			case Operation::FLOATING:
+			case Operation::LINEBREAK:
+			case Operation::LYRIC:
+			case Operation::TYPE: {
+				if (op.id < 0 || op.id >= m_notes.size()) throw std::runtime_error("Invalid note id");
+				NoteLabel *n = m_notes[op.id];
+				if (op.type == Operation::DEL) {
+					removeNote(op.id);
+					delete n;
+				} else if (op.type == Operation::MOVE) {
+					invalidateLayout(std::max(op.id - 1, 0), op.id);
+					if(op.id > 0) {
+						NoteLabel *previous = m_notes[op.id - 1];
+						if(previous->note().end > op.begin) {
+							previous->note().end = op.begin;
+							if(previous->note().begin >= previous->note().end) previous->note().begin = previous->note().end -0.01;
 						}
-						n->note().begin = op.d(2);
-						n->note().end = op.d(3);
-						n->note().note = op.i(4);
-						n->updateLabel();
-						n->setFloating(false);
-					} else if (action == "FLOATING") {
-						n->setFloating(op.b(2));
-					} else if (action == "LINEBREAK") {
-						n->setLineBreak(op.b(2));
-					} else if (action == "LYRIC") {
-						n->setLyric(op.s(2));
-					} else if (action == "TYPE") {
-						n->setType(op.i(2));
-					} else {
-						std::cerr << "Error: Unkown operation type " << action.toStdString() << std::endl;
 					}
+					n->note().begin = op.begin;
+					n->note().end = op.end;
+					n->note().note = op.note;
+					n->setFloating(false);
+				} else if (op.type == Operation::FLOATING) {
+					n->setFloating(op.state);
+					invalidateLayout(op.id, op.id);
+				} else if (op.type == Operation::LINEBREAK) {
+					n->setLineBreak(op.state);
+				} else if (op.type == Operation::LYRIC) {
+					n->setLyric(op.lyric());
+				} else {
+					n->setType(op.noteType);
 				}
+				break;
+			}
+			default:
+				std::cerr << "Error: Unkown operation type " << op.dump() << std::endl;
 			}
 		} catch (std::runtime_error&) {
 			std::cerr << "Error! Invalid operation: " << op.dump() << std::endl;
 		}
 
-		if (!(flags & Operation::NO_UPDATE))
+		if (!(flags & Operation::NO_UPDATE) && !m_batchDepth)
 			updateNotes();
+		update();
 	}
 	if (!(flags & Operation::NO_EMIT)) {
+		if (m_batchDepth) {
+			m_batchOps.push_back(op);
+			return;
+		}
 		emit operationDone(op);
 		emit updateNoteInfo(selectedNote());
 	}
 }
 
-void NoteLabelManager::zoom(float steps, double focalSecs) {
-	QScrollArea *scrollArea = getScrollArea();
-	if (!scrollArea) return;
+void NoteLabelManager::beginBatch()
+{
+	++m_batchDepth;
+}
 
-	// Default focal point is viewport center
-	if (focalSecs < 0)
-		focalSecs = px2s(scrollArea->horizontalScrollBar()->value() + scrollArea->width()/2);
+void NoteLabelManager::commitBatch()
+{
+	if (m_batchDepth == 0 || --m_batchDepth > 0) return;
+	updateNotes();
+	if (m_batchOps.isEmpty()) return;
+	// Combine to one undo operation
+	if (m_batchOps.size() > 1)
+		m_batchOps.push_back(Operation(Operation::COMBINER, m_batchOps.size()));
+	QList<Operation> ops;
+	ops.swap(m_batchOps);
+	emit operationsDone(ops);
+	emit updateNoteInfo(selectedNote());
+}
 
-	double focalFactor = (focalSecs - px2s(scrollArea->horizontalScrollBar()->value())) / px2s(scrollArea->width());
+void NoteLabelManager::zoom(float steps, double focalSecs) {
+	// Default focal point is viewport center
+	double viewSeconds = width() / m_pixelsPerSecond;
+	if (focalSecs < 0) focalSecs = m_viewBegin + viewSeconds / 2;
+	double focalFactor = (focalSecs - m_viewBegin) / viewSeconds;
 
 	// Update m_pixelsPerSecond
 	{
@@ -446,16 +586,11 @@ void NoteLabelManager::zoom(float steps, double focalSecs) {
 		m_pixelsPerSecond = pps;
 	}
 
-	setFixedSize(s2px(m_songLengthInSeconds), height());
-
-	// Update scroll bar position
-	scrollArea->horizontalScrollBar()->setValue(s2px(focalSecs) - focalFactor * scrollArea->width());
+	// Keep the focal point in place
+	updateScrollBar();
+	setViewBegin(focalSecs - focalFactor * width() / m_pixelsPerSecond);
 
-	// Update notes
-	for (int i = 0; i < m_notes.size(); ++i)
-		m_notes[i]->updateLabel();
-
-	// Update pitch visualization
+	// Repaint notes and pitch visualization
 	update();
 
 	// Update window title
@@ -464,8 +599,8 @@ void NoteLabelManager::zoom(float steps, double focalSecs) {
 
 int NoteLabelManager::getZoomLevel() const { return int(m_pixelsPerSecond / ppsNormal * 100); }
 
-int NoteLabelManager::s2px(double sec) const { return sec * m_pixelsPerSecond; }
-double NoteLabelManager::px2s(int px) const { return px / m_pixelsPerSecond; }
+int NoteLabelManager::s2px(double sec) const { return int(std::floor(sec * m_pixelsPerSecond)) - viewOffset(); }
+double NoteLabelManager::px2s(int px) const { return (px + viewOffset()) / m_pixelsPerSecond; }
 int NoteLabelManager::n2px(double note) const { return height() - 16.0 * note; }
 double NoteLabelManager::px2n(int px) const { return (height() - px) / 16.0; }
 
@@ -474,7 +609,7 @@ double NoteLabelManager::px2n(int px) const { return (height() - px) / 16.0; }
 
 void NoteLabelManager::cut()
 {
-	if (m_selectedNotes.isEmpty()) return;
+	if (m_selection.empty()) return;
 	// Copy
 	copy();
 	// Delete
@@ -483,17 +618,14 @@ void NoteLabelManager::cut()
 
 void NoteLabelManager::copy()
 {
-	if (m_selectedNotes.isEmpty()) return;
-
-	// Sort notes (so that they get created in the right order in the other end)
-	std::list<NoteLabel*> sortedNotes = m_selectedNotes.toStdList();
-	sortedNotes.sort(cmpNoteLabelPtr);
+	if (m_selection.empty()) return;
 
 	// Create operations of the notes and serialize to byte array
+	// (in time order so that they get created in the right order in the other end)
 	QByteArray buf;
 	QDataStream stream(&buf, QIODevice::WriteOnly);
-	for (std::list<NoteLabel*>::const_iterator it = sortedNotes.begin(); it != sortedNotes.end(); ++it)
-		stream << (Operation)(*(*it));
+	for (int i = m_selection.first(); i >= 0; i = m_selection.next(i))
+		stream << (Operation)(*m_notes[i]);
 
 	QClipboard *clipboard = QApplication::clipboard();
 	if (!clipboard) return;
@@ -529,24 +661,26 @@ void NoteLabelManager::paste()
 		if (my < y1 || my > y2) my = (y1 + y2) / 2.0;
 
 		// Read and execute all NoteLabel Operations from the clipboard
+		beginBatch();
 		while (!stream.atEnd()) {
 			Operation op;
 			stream >> op;
+			if (stream.status() != QDataStream::Ok || op.type != Operation::NEW) break;
 			if (first) {
 				// Calculate mouse position compensators
-				mouseTime = px2s(mx) - op.d(3);
-				mouseNote = px2n(my) - op.i(5);
+				mouseTime = px2s(mx) - op.begin;
+				mouseNote = px2n(my) - op.note;
 				first = false;
 			}
 			// Put position to mouse cursor
-			op[3] = QVariant(op.d(3) + mouseTime);
-			op[4] = QVariant(op.d(4) + mouseTime);
-			op[5] = QVariant(op.i(5) + mouseNote);
+			op.begin += mouseTime;
+			op.end += mouseTime;
+			op.note += mouseNote;
 			doOperation(op, Operation::SELECT_NEW);
 		}
+		commitBatch();
 	}
 	emit updateNoteInfo(selectedNote());
-	forcedNotePixmapUpdate();
 }
 
 double NoteLabelManager::getSongLengthInSeconds() const {
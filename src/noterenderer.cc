@@ -0,0 +1,135 @@
+#include <QPainter>
+#include <QFontMetrics>
+#include <QLinearGradient>
+#include <QtMath>
+#include "noterenderer.hh"
+#include "notelabel.hh"
+
+namespace {
+	static const int text_margin = NoteLabel::text_margin;
+	static const int radius = 8; // Corner radius of the notes
+	static const int cap = radius + 1; // Width of the rounded ends in the stretchable sprite
+	static const int stretchWidth = 2 * cap + 1; // Width of the stretchable sprite
+
+	QFont labelFont() {
+		QFont font;
+		font.setStyleStrategy(QFont::ForceOutline);
+		return font;
+	}
+
+	QPixmap newPixmap(int width, int height, qreal dpr) {
+		QPixmap pixmap(qCeil(width * dpr), qCeil(height * dpr));
+		pixmap.setDevicePixelRatio(dpr);
+		pixmap.fill(Qt::transparent);
+		return pixmap;
+	}
+}
+
+NoteRenderer::NoteRenderer(): m_lyrics(4 << 20), m_height(), m_dpr(1.0) {}
+
+void NoteRenderer::clear()
+{
+	m_bodies.clear();
+	m_lyrics.clear();
+}
+
+const QPixmap& NoteRenderer::body(const NoteLabel &note, bool selected, int width)
+{
+	quint32 key = quint32(quint8(note.note().type)) | quint32(note.isFloating()) << 8 | quint32(selected) << 9 | quint32(width) << 10;
+	QHash<quint32, QPixmap>::iterator it = m_bodies.find(key);
+	if (it != m_bodies.end()) return *it;
+
+	QRect rect(0, 0, width ? width : stretchWidth, m_height);
+	QLinearGradient gradient(0, rect.top(), 0, rect.bottom());
+	bool floating = note.isFloating();
+	float ff = floating ? 1.0f : 0.6f;
+	int alpha = floating ? 160 : ( selected ? 80 : 220 );
+	gradient.setColorAt(0.0, floating ? QColor(255, 255, 255, alpha) : QColor(50, 50, 50, alpha));
+	Note::Type type = note.note().type;
+	if (type == Note::NORMAL) {
+		gradient.setColorAt(0.2, QColor(100 * ff, 100 * ff, 255 * ff, alpha));
+		gradient.setColorAt(0.8, QColor(100 * ff, 100 * ff, 255 * ff, alpha));
+		gradient.setColorAt(1.0, QColor(100 * ff, 100 * ff, 200 * ff, alpha));
+	} else if (type == Note::GOLDEN) {
+		gradient.setColorAt(0.2, QColor(255 * ff, 255 * ff, 100 * ff, alpha));
+		gradient.setColorAt(0.8, QColor(255 * ff, 255 * ff, 100 * ff, alpha));
+		gradient.setColorAt(1.0, QColor(160 * ff, 160 * ff, 100 * ff, alpha));
+	} else if (type == Note::FREESTYLE) {
+		gradient.setColorAt(0.2, QColor(100 * ff, 180 * ff, 100 * ff, alpha));
+		gradient.setColorAt(0.8, QColor(100 * ff, 180 * ff, 100 * ff, alpha));
+		gradient.setColorAt(1.0, QColor(100 * ff, 120 * ff, 100 * ff, alpha));
+	}
+
+	QPixmap pixmap = newPixmap(rect.width(), rect.height(), m_dpr);
+	QPainter painter(&pixmap);
+	painter.setRenderHint(QPainter::Antialiasing);
+	painter.setPen(selected ? Qt::red : Qt::black); // Hilight selected note
+	painter.setBrush(gradient);
+	painter.drawRoundedRect(QRectF(rect).adjusted(0.5, 0.5, -0.5, -0.5), radius, radius);
+	painter.end();
+	return *m_bodies.insert(key, pixmap);
+}
+
+const QPixmap* NoteRenderer::lyric(const QString &text, bool selected)
+{
+	QString key = (selected ? '1' : '0') + text;
+	if (QPixmap *cached = m_lyrics.object(key)) return cached;
+
+	QFont font = labelFont();
+	QFontMetrics fm(font);
+	QSize size(qMax(fm.width(text), 1), fm.height());
+	QPixmap *pixmap = new QPixmap(newPixmap(size.width(), size.height(), m_dpr));
+	QPainter painter(pixmap);
+	painter.setFont(font);
+	painter.setPen(selected ? Qt::red : Qt::white);
+	painter.drawText(QRect(QPoint(), size), Qt::AlignCenter, text);
+	painter.end();
+	m_lyrics.insert(key, pixmap, size.width() * size.height());
+	return pixmap; // QCache only evicts on the next insert
+}
+
+void NoteRenderer::paint(QPainter &painter, const NoteLabel &note, const QRect &rect, bool selected)
+{
+	if (rect.isEmpty()) return;
+
+	// Sprites are only valid for one height and pixel density
+	qreal dpr = painter.device()->devicePixelRatioF();
+	if (rect.height() != m_height || dpr != m_dpr) {
+		clear();
+		m_height = rect.height();
+		m_dpr = dpr;
+	}
+
+	// Body: the caps as such and the middle column stretched in between
+	if (rect.width() < stretchWidth) {
+		painter.drawPixmap(rect.topLeft(), body(note, selected, rect.width()));
+	} else {
+		const QPixmap &sprite = body(note, selected, 0);
+		qreal sc = cap * m_dpr, sh = m_height * m_dpr;
+		painter.drawPixmap(QRectF(rect.left(), rect.top(), cap, m_height), sprite, QRectF(0, 0, sc, sh));
+		painter.drawPixmap(QRectF(rect.left() + cap, rect.top(), rect.width() - 2 * cap, m_height), sprite, QRectF(sc, 0, m_dpr, sh));
+		painter.drawPixmap(QRectF(rect.right() + 1 - cap, rect.top(), cap, m_height), sprite, QRectF(sc + m_dpr, 0, sc, sh));
+	}
+
+	// Lyric, centered and clipped to the area inside the margins
+	if (!note.lyric().isEmpty()) {
+		const QPixmap *text = lyric(note.lyric(), selected);
+		QRect inner = rect.adjusted(text_margin, text_margin, -text_margin, -text_margin);
+		QSize size = text->size() / m_dpr;
+		QRect target(inner.left() + (inner.width() - size.width()) / 2, inner.top() + (inner.height() - size.height()) / 2,
+			size.width(), size.height());
+		QRect visible = target.intersected(inner);
+		if (!visible.isEmpty()) {
+			QRectF source(QRectF(visible.translated(-target.topLeft())).topLeft() * m_dpr, QSizeF(visible.size()) * m_dpr);
+			painter.drawPixmap(QRectF(visible), *text, source);
+		}
+	}
+
+	// Render sentence end indicator
+	if (note.isLineBreak()) {
+		painter.save();
+		painter.setPen(QPen(QBrush(QColor(255, 0, 0)), 4));
+		painter.drawLine(rect.left() + 2, rect.top(), rect.left() + 2, rect.bottom());
+		painter.restore();
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <QCache>
+#include <QHash>
+#include <QPixmap>
+#include <QString>
+
+class QPainter;
+class QRect;
+class NoteLabel;
+
+/**
+ * @brief Paints NoteLabels from cached sprites.
+ *
+ * The note bodies only depend on type, floating and selection state (the
+ * gradient is vertical), so one sprite per state is rasterized and stretched
+ * horizontally between its rounded caps; only notes narrower than the caps get
+ * sprites of their own width. Lyrics are rasterized once per text and colour.
+ * Zooming or selecting thus only blits pixmaps.
+ */
+class NoteRenderer
+{
+public:
+	NoteRenderer();
+
+	/// Draw the note into the given rectangle
+	void paint(QPainter &painter, const NoteLabel &note, const QRect &rect, bool selected);
+	/// Drop all cached sprites
+	void clear();
+
+private:
+	const QPixmap& body(const NoteLabel &note, bool selected, int width);
+	const QPixmap* lyric(const QString &text, bool selected);
+
+	QHash<quint32, QPixmap> m_bodies;  ///< Key: type, floating, selected and width (0 for the stretchable sprite)
+	QCache<QString, QPixmap> m_lyrics;  ///< Key: selection flag followed by the lyric
+	int m_height;  ///< Height of the cached sprites
+	qreal m_dpr;  ///< Device pixel ratio of the cached sprites
+};
@@ -59,6 +59,7 @@ Duration::Duration(): begin(getNaN()), end(getNaN()) {}
 
 
 const Note::Type Note::types[] = { NORMAL, GOLDEN, FREESTYLE, SLIDE, SLEEP, TAP, HOLDBEGIN, HOLDEND, ROLL, MINE, LIFT };
+const int Note::typeCount = sizeof(Note::types) / sizeof(Note::types[0]);
 
 Note::Note(QString lyric): syllable(lyric), begin(), end(), phase(getNaN()), type(NORMAL), note(), notePrev(), lineBreak() {}
 
@@ -58,6 +58,7 @@ struct Note {
 	enum Type { FREESTYLE = 'F', NORMAL = ':', GOLDEN = '*', SLIDE = '+', SLEEP = '-',
 		TAP = '1', HOLDBEGIN = '2', HOLDEND = '3', ROLL = '4', MINE = 'M', LIFT = 'L'} type;
 	static const Type types[];
+	static const int typeCount; ///< Number of elements in types
 	int getTypeInt() const;
 
 	//Duration duration; ///< note begin/end
@@ -0,0 +1,98 @@
+#include "noteselection.hh"
+
+int NoteSelection::popCount(Word w)
+{
+	int n = 0;
+	for (; w; ++n) w &= w - 1; // Clear the lowest set bit
+	return n;
+}
+
+int NoteSelection::next(int id) const
+{
+	if (m_count == 0) return -1;
+	unsigned start = unsigned(id + 1);
+	for (unsigned w = start / 64; w < m_words.size(); ++w) {
+		Word word = m_words[w];
+		if (w == start / 64) word &= ~lowMask(start % 64);
+		if (!word) continue;
+		int bit = 0;
+		while (!(word & 1)) { word >>= 1; ++bit; }
+		return w * 64 + bit;
+	}
+	return -1;
+}
+
+void NoteSelection::clear()
+{
+	m_words.clear();
+	m_count = 0;
+	m_primary = -1;
+}
+
+void NoteSelection::select(int id, bool makePrimary)
+{
+	if (id < 0) return;
+	unsigned w = unsigned(id) / 64;
+	if (w >= m_words.size()) m_words.resize(w + 1);
+	Word bit = Word(1) << (id % 64);
+	if (!(m_words[w] & bit)) {
+		m_words[w] |= bit;
+		++m_count;
+	}
+	if (makePrimary || m_primary < 0) m_primary = id;
+}
+
+void NoteSelection::deselect(int id)
+{
+	if (!contains(id)) return;
+	m_words[id / 64] &= ~(Word(1) << (id % 64));
+	--m_count;
+	resetPrimary();
+}
+
+void NoteSelection::selectRange(int first, int last)
+{
+	if (first < 0) first = 0;
+	if (last < first) return;
+	unsigned lw = unsigned(last) / 64;
+	if (lw >= m_words.size()) m_words.resize(lw + 1);
+	for (unsigned w = unsigned(first) / 64; w <= lw; ++w) {
+		Word mask = ~Word();
+		if (w == unsigned(first) / 64) mask &= ~lowMask(first % 64);
+		if (w == lw) mask &= lowMask(last % 64 + 1);
+		m_count += popCount(mask & ~m_words[w]);
+		m_words[w] |= mask;
+	}
+	if (m_primary < 0) m_primary = first;
+}
+
+void NoteSelection::insert(int id)
+{
+	if (m_primary >= id) ++m_primary;
+	unsigned w = unsigned(id) / 64, b = id % 64;
+	Word carry = 0;
+	for (unsigned i = w; i < m_words.size(); ++i) {
+		Word word = m_words[i];
+		Word moving = (i == w) ? (word & ~lowMask(b)) : word;
+		Word keep = word & ~moving;
+		m_words[i] = keep | (moving << 1) | carry;
+		carry = moving >> 63;
+	}
+	if (carry) m_words.push_back(carry);
+}
+
+void NoteSelection::remove(int id)
+{
+	bool wasSelected = contains(id);
+	if (wasSelected) --m_count;
+	unsigned w = unsigned(id) / 64, b = id % 64;
+	for (unsigned i = w; i < m_words.size(); ++i) {
+		Word word = m_words[i];
+		Word high = (i + 1 < m_words.size()) ? (m_words[i + 1] & 1) << 63 : 0;
+		Word shifted = (word >> 1) | high;
+		m_words[i] = (i == w) ? ((word & lowMask(b)) | (shifted & ~lowMask(b))) : shifted;
+	}
+	if (m_primary == id) m_primary = -1;
+	else if (m_primary > id) --m_primary;
+	if (wasSelected || m_primary < 0) resetPrimary();
+}
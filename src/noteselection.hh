@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Set of selected notes as a bitset over note ids (positions in NoteLabelManager).
+ *
+ * Membership is O(1), ranges are set word by word and insert()/remove() keep
+ * the ids in sync when notes are added or deleted.
+ */
+class NoteSelection
+{
+public:
+	NoteSelection(): m_count(), m_primary(-1) {}
+
+	bool contains(int id) const {
+		unsigned w = unsigned(id) / 64;
+		return id >= 0 && w < m_words.size() && (m_words[w] >> (id % 64) & 1);
+	}
+	int count() const { return m_count; }
+	bool empty() const { return m_count == 0; }
+	/// The note that was selected last (the lowest selected id if that one was deselected), -1 if none
+	int primary() const { return m_primary; }
+	/// Lowest selected id, -1 if none
+	int first() const { return next(-1); }
+	/// Lowest selected id above id, -1 if none
+	int next(int id) const;
+
+	void clear();
+	void select(int id, bool makePrimary = true);
+	void deselect(int id);
+	/// Select ids first..last (inclusive)
+	void selectRange(int first, int last);
+	void setPrimary(int id) { if (contains(id)) m_primary = id; }
+
+	/// A note was inserted at id: ids from there on move up by one
+	void insert(int id);
+	/// The note at id was removed: ids after it move down by one
+	void remove(int id);
+
+private:
+	typedef std::uint64_t Word;
+	static Word lowMask(unsigned bits) { return bits ? (~Word() >> (64 - bits)) : 0; }
+	static int popCount(Word w);
+	void resetPrimary() { if (!contains(m_primary)) m_primary = first(); }
+
+	std::vector<Word> m_words;
+	int m_count;
+	int m_primary;
+};
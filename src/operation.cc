@@ -1,14 +1,287 @@
 #include "operation.hh"
+#include <QHash>
+#include <QVector>
+#include <QTextStream>
+
+namespace {
+	const char* const opNames[] = { "", "BLOCK", "COMBINER", "CLEAR", "NEW", "DEL", "MOVE", "FLOATING", "LINEBREAK", "LYRIC", "TYPE", "META" };
+	const int opCount = sizeof(opNames) / sizeof(*opNames);
+
+	/// Interned strings (never freed, the undo history may refer to them at any time)
+	struct StringTable {
+		StringTable() { strings.push_back(QString()); index[QString()] = 0; }
+		QHash<QString, unsigned> index;
+		QVector<QString> strings;
+	};
+
+	StringTable& stringTable() {
+		static StringTable table;
+		return table;
+	}
+
+	enum Bits { BIT_STATE = 1, BIT_LINEBREAK = 2 };
+}
+
+
+Operation Operation::newNote(int id, const Note &n, bool floating)
+{
+	Operation op(NEW, id);
+	op.text = intern(n.syllable);
+	op.begin = n.begin;
+	op.end = n.end;
+	op.note = n.note;
+	op.state = floating;
+	op.lineBreak = n.lineBreak;
+	op.noteType = n.getTypeInt();
+	return op;
+}
+
+Operation Operation::move(int id, double begin, double end, int note)
+{
+	Operation op(MOVE, id);
+	op.begin = begin;
+	op.end = end;
+	op.note = note;
+	return op;
+}
+
+Operation Operation::setLyric(int id, const QString &lyric)
+{
+	Operation op(LYRIC, id);
+	op.text = intern(lyric);
+	return op;
+}
+
+Operation Operation::setType(int id, int noteType)
+{
+	Operation op(TYPE, id);
+	op.noteType = noteType;
+	return op;
+}
+
+Operation Operation::meta(const QString &key, const QString &value)
+{
+	Operation op(META);
+	op.key = intern(key);
+	op.text = intern(value);
+	return op;
+}
+
+Note Operation::toNote() const
+{
+	Note n(lyric());
+	n.begin = begin;
+	n.end = end;
+	n.note = note;
+	n.lineBreak = lineBreak;
+	n.type = Note::types[noteType];
+	return n;
+}
+
+QString Operation::name() const
+{
+	return (type > INVALID && type < opCount) ? opNames[type] : "";
+}
+
+std::string Operation::dump() const
+{
+	QString st;
+	QTextStream ts(&st);
+	foreach(QVariant qv, toVariants())
+		ts << qv.toString() << " ";
+	return st.toStdString();
+}
+
+Operation Operation::fromVariants(const QList<QVariant> &params)
+{
+	Type t = INVALID;
+	if (!params.isEmpty()) {
+		QString opName = params.front().toString();
+		for (int i = 1; i < opCount; ++i)
+			if (opName == opNames[i]) t = Type(i);
+	}
+	// Number of parameters (including the name) for each type
+	static const int sizes[] = { 0, 1, 2, 1, 9, 2, 5, 3, 3, 3, 3, 3 };
+	if (t == INVALID || params.size() < sizes[t])
+		throw std::runtime_error("Invalid operation in old format");
+
+	Operation op(t);
+	switch (t) {
+		case NEW:
+			op.id = params[1].toInt();
+			op.text = intern(params[2].toString());
+			op.begin = params[3].toDouble();
+			op.end = params[4].toDouble();
+			op.note = params[5].toInt();
+			op.state = params[6].toBool();
+			op.lineBreak = params[7].toBool();
+			op.noteType = params[8].toInt();
+			break;
+		case MOVE:
+			op.id = params[1].toInt();
+			op.begin = params[2].toDouble();
+			op.end = params[3].toDouble();
+			op.note = params[4].toInt();
+			break;
+		case FLOATING: case LINEBREAK:
+			op.id = params[1].toInt();
+			op.state = params[2].toBool();
+			break;
+		case LYRIC:
+			op.id = params[1].toInt();
+			op.text = intern(params[2].toString());
+			break;
+		case TYPE:
+			op.id = params[1].toInt();
+			op.noteType = params[2].toInt();
+			break;
+		case META:
+			op.key = intern(params[1].toString());
+			op.text = intern(params[2].toString());
+			break;
+		case COMBINER: case DEL:
+			op.id = params[1].toInt();
+			break;
+		default:
+			break;
+	}
+	if (op.noteType < 0 || op.noteType >= Note::typeCount)
+		throw std::runtime_error("Invalid note type in old format operation");
+	return op;
+}
+
+QList<QVariant> Operation::toVariants() const
+{
+	QList<QVariant> params;
+	params << QVariant(name());
+	switch (type) {
+		case NEW:
+			params << QVariant(id) << QVariant(lyric()) << QVariant(begin) << QVariant(end) << QVariant(note)
+				<< QVariant(state) << QVariant(lineBreak) << QVariant(int(noteType));
+			break;
+		case MOVE:
+			params << QVariant(id) << QVariant(begin) << QVariant(end) << QVariant(note);
+			break;
+		case FLOATING: case LINEBREAK:
+			params << QVariant(id) << QVariant(state);
+			break;
+		case LYRIC:
+			params << QVariant(id) << QVariant(lyric());
+			break;
+		case TYPE:
+			params << QVariant(id) << QVariant(int(noteType));
+			break;
+		case META:
+			params << QVariant(metaKey()) << QVariant(metaValue());
+			break;
+		case COMBINER: case DEL:
+			params << QVariant(id);
+			break;
+		default:
+			break;
+	}
+	return params;
+}
+
+unsigned Operation::intern(const QString &str)
+{
+	StringTable &table = stringTable();
+	QHash<QString, unsigned>::const_iterator it = table.index.find(str);
+	if (it != table.index.end()) return it.value();
+	unsigned index = table.strings.size();
+	table.strings.push_back(str);
+	table.index.insert(str, index);
+	return index;
+}
+
+QString Operation::string(unsigned index)
+{
+	StringTable &table = stringTable();
+	if (index >= unsigned(table.strings.size())) throw std::runtime_error("Invalid string index in operation");
+	return table.strings[index];
+}
 
 
 QDataStream& operator<<(QDataStream& stream, const Operation& op)
 {
-	stream << op.m_params;
+	stream << quint8(op.type);
+	switch (op.type) {
+		case Operation::NEW:
+			stream << qint32(op.id) << op.lyric() << op.begin << op.end << qint32(op.note)
+				<< quint8((op.state ? BIT_STATE : 0) | (op.lineBreak ? BIT_LINEBREAK : 0)) << op.noteType;
+			break;
+		case Operation::MOVE:
+			stream << qint32(op.id) << op.begin << op.end << qint32(op.note);
+			break;
+		case Operation::FLOATING: case Operation::LINEBREAK:
+			stream << qint32(op.id) << quint8(op.state);
+			break;
+		case Operation::LYRIC:
+			stream << qint32(op.id) << op.lyric();
+			break;
+		case Operation::TYPE:
+			stream << qint32(op.id) << op.noteType;
+			break;
+		case Operation::META:
+			stream << op.metaKey() << op.metaValue();
+			break;
+		case Operation::COMBINER: case Operation::DEL:
+			stream << qint32(op.id);
+			break;
+		default:
+			break;
+	}
 	return stream;
 }
 
 QDataStream& operator>>(QDataStream& stream, Operation& op)
 {
-	stream >> op.m_params;
+	quint8 type;
+	stream >> type;
+	if (type == Operation::INVALID || type >= opCount) {
+		stream.setStatus(QDataStream::ReadCorruptData);
+		return stream;
+	}
+	op = Operation(Operation::Type(type));
+	qint32 id = 0, note = 0;
+	quint8 bits = 0;
+	QString str1, str2;
+	switch (op.type) {
+		case Operation::NEW:
+			stream >> id >> str1 >> op.begin >> op.end >> note >> bits >> op.noteType;
+			op.text = Operation::intern(str1);
+			break;
+		case Operation::MOVE:
+			stream >> id >> op.begin >> op.end >> note;
+			break;
+		case Operation::FLOATING: case Operation::LINEBREAK:
+			stream >> id >> bits;
+			break;
+		case Operation::LYRIC:
+			stream >> id >> str1;
+			op.text = Operation::intern(str1);
+			break;
+		case Operation::TYPE:
+			stream >> id >> op.noteType;
+			break;
+		case Operation::META:
+			stream >> str1 >> str2;
+			op.key = Operation::intern(str1);
+			op.text = Operation::intern(str2);
+			break;
+		case Operation::COMBINER: case Operation::DEL:
+			stream >> id;
+			break;
+		default:
+			break;
+	}
+	if (op.noteType < 0 || op.noteType >= Note::typeCount) {
+		stream.setStatus(QDataStream::ReadCorruptData);
+		return stream;
+	}
+	op.id = id;
+	op.note = note;
+	op.state = bits & BIT_STATE;
+	op.lineBreak = bits & BIT_LINEBREAK;
 	return stream;
 }
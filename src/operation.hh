@@ -1,76 +1,80 @@
 #pragma once
 #include <QString>
 #include <QStack>
+#include <QList>
 #include <QVariant>
 #include <QTextStream>
 #include <QDataStream>
 #include <ostream>
 #include <stdexcept>
+#include "notes.hh"
 
+/**
+ * @brief A single editing step, as stored in the undo history, clipboard and project files.
+ *
+ * Operations are small tagged records: an opcode and a fixed set of plain fields
+ * whose meaning depends on the opcode (see the factory functions). Strings are
+ * interned, so copying and replaying Operations does not touch the string data.
+ *
+ * The old representation (a list of QVariants starting with the op name) is
+ * still supported through fromVariants() / toVariants() for older project files.
+ */
 struct Operation
 {
 	enum OperationFlags { NORMAL = 0, NO_EXEC = 1, NO_EMIT = 2, NO_UPDATE = 4, SELECT_NEW = 8 };
 
-	Operation() { }
-	Operation(const QString &opString) { *this << opString; }
-	Operation(const QString &opString, int id) { *this << opString << id; }
-	Operation(const QString &opString, int id, bool state) { *this << opString << id << state; }
-	Operation(const QString &opString, const QString &str1, const QString &str2) { *this << opString << str1 << str2; }
+	/// Operation types - NOTE! The values are stored in project files, only append new ones
+	enum Type { INVALID, BLOCK, COMBINER, CLEAR, NEW, DEL, MOVE, FLOATING, LINEBREAK, LYRIC, TYPE, META };
 
-	// Functions to add parameters to Operation
+	/// Operation without parameters or with only a note id (COMBINER: number of combined operations)
+	explicit Operation(Type opType = INVALID, int noteId = 0)
+		: type(opType), id(noteId), begin(), end(), note(), noteType(), state(), lineBreak(), text(), key() {}
+	/// FLOATING or LINEBREAK
+	Operation(Type opType, int noteId, bool newState)
+		: type(opType), id(noteId), begin(), end(), note(), noteType(), state(newState), lineBreak(), text(), key() {}
 
-	Operation& operator<<(const QString &str) { m_params.push_back(QVariant(str)); return *this; }
-	Operation& operator<<(int i) { m_params.push_back(QVariant(i)); return *this; }
-	Operation& operator<<(bool b) { m_params.push_back(QVariant(b)); return *this; }
-	Operation& operator<<(float f) { m_params.push_back(QVariant(f)); return *this; }
-	Operation& operator<<(double d) { m_params.push_back(QVariant(d)); return *this; }
-	Operation& operator<<(QVariant q) { m_params.push_back(q); return *this; }
+	/// Create a note at position id (-1 = choose by begin time)
+	static Operation newNote(int id, const Note &n, bool floating);
+	static Operation move(int id, double begin, double end, int note);
+	static Operation setLyric(int id, const QString &lyric);
+	static Operation setType(int id, int noteType);
+	static Operation meta(const QString &key, const QString &value);
 
-	/// Get the operation id
-	QString op() const { return m_params.isEmpty() ? "" : m_params.front().toString(); }
-	/// Get parameter count (excluding operation id)
-	int paramCount() const { return m_params.size() - 1; }
+	/// Lyric of NEW and LYRIC, value of META
+	QString lyric() const { return string(text); }
+	QString metaKey() const { return string(key); }
+	QString metaValue() const { return string(text); }
+	/// Note described by a NEW operation
+	Note toNote() const;
 
-	/// Overloaded template getter for param at certain position (1-based)
-	template<typename T>
-	T param(int index) const { validate(index); m_params[index].value<T>(); }
+	/// Name of the operation type as used in the old file format
+	QString name() const;
+	std::string dump() const;
 
-	// Get Operation parameter at certain index (1-based)
+	/// Convert from the old representation (throws std::runtime_error if invalid)
+	static Operation fromVariants(const QList<QVariant> &params);
+	/// Convert to the old representation
+	QList<QVariant> toVariants() const;
 
-	QString s(int index) const { validate(index); return m_params[index].toString(); }
-	char c(int index) const { validate(index); return m_params[index].toChar().toLatin1(); }
-	int i(int index) const { validate(index); return m_params[index].toInt(); }
-	unsigned u(int index) const { validate(index); return m_params[index].toUInt(); }
-	bool b(int index) const { validate(index); return m_params[index].toBool(); }
-	float f(int index) const { validate(index); return m_params[index].toFloat(); }
-	double d(int index) const { validate(index); return m_params[index].toDouble(); }
-	QVariant q(int index) const { validate(index); return m_params[index]; }
+	/// Index of str in the string table (adds it if needed)
+	static unsigned intern(const QString &str);
+	/// String from the string table
+	static QString string(unsigned index);
 
-	/// Array access for modifying param
-	QVariant& operator[](int index) { validate(index); return m_params[index]; }
-
-	std::string dump() const {
-		QString st;
-		QTextStream ts(&st);
-		foreach(QVariant qv, m_params)
-			ts << qv.toString() << " ";
-		return st.toStdString();
-	}
-
-	friend QDataStream& operator<<(QDataStream&, const Operation&);
-	friend QDataStream& operator>>(QDataStream& stream, Operation& op);
-
-private:
-	void validate(int index) const {
-		if (index < 0 || index >= m_params.size())
-			throw std::runtime_error("Invalid access to operation parameters");
-	}
-
-	QList<QVariant> m_params;
+	Type type;
+	int id;  ///< Note id (COMBINER: number of operations combined)
+	double begin;  ///< NEW, MOVE
+	double end;  ///< NEW, MOVE
+	int note;  ///< Pitch (NEW, MOVE)
+	qint8 noteType;  ///< Index to Note::types (NEW, TYPE)
+	bool state;  ///< Floating (NEW, FLOATING) or line break (LINEBREAK)
+	bool lineBreak;  ///< NEW
+	unsigned text;  ///< Interned lyric (NEW, LYRIC) or value (META)
+	unsigned key;  ///< Interned key (META)
 };
 
 typedef QStack<Operation> OperationStack;
 
-// Serialization operators
+// Serialization operators (compact binary format, sets ReadCorruptData on invalid input)
 QDataStream& operator<<(QDataStream& stream, const Operation& op);
 QDataStream& operator>>(QDataStream& stream, Operation& op);
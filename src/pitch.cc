@@ -1,16 +1,27 @@
 #include "pitch.hh"
 
+#include "pitchyin.hh"
 #include "libda/fft.hpp"
 #include <cmath>
 #include <numeric>
 
-static const unsigned FFT_P = 12;  // FFT size setting, will use 2^FFT_P sample FFT
-static const std::size_t FFT_N = 1 << FFT_P;  // FFT size in samples
-static const std::size_t FFT_STEP = 512;  // Step size in samples, should be <= 0.25 * FFT_N. Low values cause high CPU usage.
+namespace {
+	template <unsigned P> Analyzer::Fourier fft(float const* pcm, std::vector<float> const& window) {
+		return da::fft<P, float const*, std::vector<float> const&>(pcm, window);  // No copy of the window
+	}
+	// The FFT is fully unrolled for each size, pick one at runtime
+	Analyzer::Fourier (* const fftFunctions[])(float const*, std::vector<float> const&) = {
+		fft<10>, fft<11>, fft<12>, fft<13>, fft<14>
+	};
+	static_assert(sizeof(fftFunctions) / sizeof(*fftFunctions) == AnalyzerConfig::MAX_FFT_P - AnalyzerConfig::MIN_FFT_P + 1,
+	  "fftFunctions must cover the AnalyzerConfig FFT sizes");
+}
 
-// Limit the range to avoid noise and useless computation
-static const double FFT_MINFREQ = 45.0;
-static const double FFT_MAXFREQ = 3000.0;
+void AnalyzerConfig::validate() const {
+	if (fftP < MIN_FFT_P || fftP > MAX_FFT_P) throw std::invalid_argument("FFT size must be 2^10..2^14");
+	if (step == 0 || step > (1u << fftP) / 4) throw std::invalid_argument("Step must be 1..FFT size / 4");
+	if (!(minFreq > 0.0 && minFreq < maxFreq)) throw std::invalid_argument("Invalid frequency range");
+}
 
 Tone::Tone(): freq(), level(), prev(), next() {
 	for (std::size_t i = 0; i < MAXHARM; ++i) harmonics[i] = 0.0;
@@ -20,24 +31,27 @@ bool Tone::operator==(double f) const {
 	return std::abs(freq / f - 1.0) < 0.06;  // Half semitone
 }
 
-Analyzer::Analyzer(double rate, std::string id):
-  m_rate(rate),
+Analyzer::Analyzer(double rate, std::string id, AnalyzerConfig const& config):
+  PitchEngine(rate),
   m_id(id),
-  m_window(FFT_N),
-  m_fftLastPhase(FFT_N / 2),
+  m_config((config.validate(), config)),
+  m_fftN(std::size_t(1) << config.fftP),
+  m_fftFunction(fftFunctions[config.fftP - AnalyzerConfig::MIN_FFT_P]),
+  m_window(m_fftN),
+  m_fftLastPhase(m_fftN / 2),
   m_oldfreq(0.0)
 {
   	// Hamming window
-	for (size_t i=0; i < FFT_N; i++) {
-		m_window[i] = 0.53836 - 0.46164 * std::cos(2.0 * M_PI * i / (FFT_N - 1));
+	for (size_t i=0; i < m_fftN; i++) {
+		m_window[i] = 0.53836 - 0.46164 * std::cos(2.0 * M_PI * i / (m_fftN - 1));
 	}
 }
 
-unsigned Analyzer::processSize() const { return FFT_N; }
-unsigned Analyzer::processStep() const { return FFT_STEP; }
+unsigned Analyzer::processSize() const { return m_fftN; }
+unsigned Analyzer::processStep() const { return m_config.step; }
 
 void Analyzer::calcFFT(float* pcm) {
-	m_fft = da::fft<FFT_P>(pcm, m_window);
+	m_fft = m_fftFunction(pcm, m_window);
 }
 
 namespace {
@@ -56,12 +70,12 @@ bool Combo::match(double freqOther) const { return matchFreq(freq, freqOther); }
 
 void Analyzer::calcTones() {
 	// Precalculated constants
-	const double freqPerBin = m_rate / FFT_N;
-	const double phaseStep = 2.0 * M_PI * FFT_STEP / FFT_N;
-	const double normCoeff = 1.0 / FFT_N;
+	const double freqPerBin = m_rate / m_fftN;
+	const double phaseStep = 2.0 * M_PI * m_config.step / m_fftN;
+	const double normCoeff = 1.0 / m_fftN;
 	// Limit frequency range of processing
-	const size_t kMin = std::max(size_t(3), size_t(FFT_MINFREQ / freqPerBin));
-	const size_t kMax = std::min(FFT_N / 2, size_t(FFT_MAXFREQ / freqPerBin));
+	const size_t kMin = std::max(size_t(3), size_t(m_config.minFreq / freqPerBin));
+	const size_t kMax = std::min(m_fftN / 2, size_t(m_config.maxFreq / freqPerBin));
 	m_peaks.resize(kMax);
 	// Process FFT into peaks
 	for (size_t k = 1; k < kMax; ++k) {
@@ -82,7 +96,7 @@ void Analyzer::calcTones() {
 	Combos combos;
 	for (size_t k = kMin; k < kMax; ++k) {
 		Peak const& p = m_peaks[k];
-		bool ok = p.level > 1e-3 && p.freq >= FFT_MINFREQ && p.freq <= FFT_MAXFREQ && std::abs(p.freqFFT - p.freq) < freqPerBin;
+		bool ok = p.level > 1e-3 && p.freq >= m_config.minFreq && p.freq <= m_config.maxFreq && std::abs(p.freqFFT - p.freq) < freqPerBin;
 		if (!ok) continue;
 		// Do we need to add a new Combo (rather than using the last one)?
 		if (combos.empty() || !combos.back().match(p.freq)) combos.push_back(Combo());
@@ -104,7 +118,7 @@ void Analyzer::calcTones() {
 			Tone tone;
 			int plausibleHarmonics = 0;
 			double basefreq = it->freq / div;
-			if (basefreq < FFT_MINFREQ) break;  // Do not try any lower frequencies
+			if (basefreq < m_config.minFreq) break;  // Do not try any lower frequencies
 			for (Combos::const_iterator harm = it; harm != itend; ++harm) {
 				double ratio = harm->freq / basefreq;
 				unsigned n = round(ratio);
@@ -139,7 +153,7 @@ void Analyzer::calcTones() {
 	temporalMerge(tones);
 }
 
-void Analyzer::temporalMerge(Tones& tones) {
+void PitchEngine::temporalMerge(Tones& tones) {
 	if (!m_moments.empty()) {
 		Tones& old = m_moments.back().m_tones;
 		Tones::iterator it = tones.begin();
@@ -165,3 +179,19 @@ void Moment::stealTones(Tones& tones) {
 	m_tones.swap(tones);
 }
 
+
+std::unique_ptr<PitchEngine> PitchEngine::create(Type type, double rate, AnalyzerConfig const& config) {
+	config.validate();
+	if (type == YIN) return std::unique_ptr<PitchEngine>(new YinAnalyzer(rate, config.step));
+	return std::unique_ptr<PitchEngine>(new Analyzer(rate, "", config));
+}
+
+char const* PitchEngine::name(Type type) {
+	return type == YIN ? "yin" : "harmonic";
+}
+
+PitchEngine::Type PitchEngine::type(std::string const& name) {
+	if (name == "harmonic") return HARMONIC;
+	if (name == "yin") return YIN;
+	throw std::invalid_argument("Unknown pitch detection method " + name);
+}
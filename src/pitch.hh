@@ -4,6 +4,8 @@
 #include <complex>
 #include <vector>
 #include <list>
+#include <memory>
+#include <string>
 #include <algorithm>
 #include <cmath>
 
@@ -60,46 +62,102 @@ struct Combo {
 };
 
 
+/**
+ * @brief Time and frequency resolution of the analysis.
+ *
+ * Larger FFTs resolve low notes better but smear fast changes, smaller hops
+ * follow the pitch more closely but cost proportionally more CPU.
+ */
+struct AnalyzerConfig {
+	static const unsigned MIN_FFT_P = 10, MAX_FFT_P = 14;  ///< The FFT sizes compiled in
+	unsigned fftP;  ///< FFT size setting, will use 2^fftP sample FFT (harmonic engine)
+	unsigned step;  ///< Step size in samples, should be <= 0.25 * FFT size
+	double minFreq, maxFreq;  ///< Frequency range (Hz) of the harmonic engine, limited to avoid noise and useless computation
+	AnalyzerConfig(unsigned fftP = 12, unsigned step = 512, double minFreq = 45.0, double maxFreq = 3000.0):
+	  fftP(fftP), step(step), minFreq(minFreq), maxFreq(maxFreq) {}
+	/// Quick coarse pass, e.g. to show something while the full analysis runs
+	static AnalyzerConfig preview() { return AnalyzerConfig(11, 512); }
+	/// Dense pass for timing notes precisely
+	static AnalyzerConfig fine() { return AnalyzerConfig(12, 256); }
+	/// Throws std::invalid_argument unless the values are usable
+	void validate() const;
+};
+
+/**
+ * @brief Pitch detection algorithm.
+ *
+ * Each call to process() analyzes one frame of mono audio into a Moment of
+ * tones, linked to the matching tones of the previous moment so that
+ * continuous tones can be followed over time. One instance per channel.
+ */
+class PitchEngine {
+public:
+	typedef std::list<Tone> Tones; ///< Tones (the final level of detection)
+	typedef std::list<Moment> Moments; ///< Time-serie history of time and tones
+	/// Available algorithms
+	enum Type {
+		HARMONIC, ///< FFT peaks combined into harmonic series, copes with mixed music
+		YIN ///< Time-domain autocorrelation of a single voice, for isolated vocals
+	};
+	/// Create an engine of the given type
+	static std::unique_ptr<PitchEngine> create(Type type, double rate, AnalyzerConfig const& config = AnalyzerConfig());
+	/// Short name of type for settings and command lines
+	static char const* name(Type type);
+	/// Type by name(), throws std::invalid_argument for unknown names
+	static Type type(std::string const& name);
+	virtual ~PitchEngine() {}
+	/** Get a list of all tones detected. **/
+	Moments const& getMoments() const { return m_moments; }
+	/// Process processSize() samples from RndIt input
+	template<typename RndIt> void process(RndIt input) {
+		std::vector<float> pcm(input, input + processSize());  // Needs local modifyable copy for calculations
+		processFrame(pcm);
+	}
+	virtual unsigned processSize() const = 0;  ///< The number of samples required by process()
+	virtual unsigned processStep() const = 0;  ///< The number of samples to increment the input position after each call to process()
+	double getTime() const { return m_moments.empty() ? 0.0 : m_moments.back().time(); }
+protected:
+	PitchEngine(double rate): m_rate(rate) {}
+	/// Analyze processSize() samples (which may be modified) and add a moment by temporalMerge()
+	virtual void processFrame(std::vector<float>& pcm) = 0;
+	/// Link tones to the previous moment and append them as a new moment
+	void temporalMerge(Tones& tones);
+	double m_rate;
+private:
+	Moments m_moments;
+};
+
 /// analyzer class
  /** class to analyze input audio and transform it into useable data
  */
-class Analyzer {
+class Analyzer: public PitchEngine {
 public:
 	typedef std::vector<std::complex<float> > Fourier;  ///< FFT vector (the first level of detection)
 	typedef std::vector<Peak> Peaks;  ///< Peaks (the second level of detection)
-	typedef std::list<Tone> Tones; ///< Tones (the final level of detection)
-	typedef std::list<Moment> Moments; ///< Time-serie history of time and tones
 	/// constructor
-	Analyzer(double rate, std::string id);
+	Analyzer(double rate, std::string id = std::string(), AnalyzerConfig const& config = AnalyzerConfig());
 	/** Get the fourier transform. **/
 	Fourier const& getFourier() const { return m_fft; }
 	/** Get the peak frequencies. **/
 	Peaks const& getPeaks() const { return m_peaks; }
-	/** Get a list of all tones detected. **/
-	Moments const& getMoments() const { return m_moments; }
 	/** Find a tone within the singing range; prefers strong tones around 200-400 Hz. **/
 	//Tone const* findTone(double minfreq = 70.0, double maxfreq = 700.0) const;
 	std::string const& getId() const { return m_id; }
-	/// Process processSize() samples from RndIt input
-	template<typename RndIt> void process(RndIt input) {
-		std::vector<float> pcm(input, input + processSize());  // Needs local modifyable copy for calculations
-		calcFFT(&pcm[0]);
-		calcTones();
-	}
-	unsigned processSize() const;  ///< The number of samples required by process()
-	unsigned processStep() const;  ///< The number of samples to increment the input position after each call to process()
-	double getTime() const { return m_moments.empty() ? 0.0 : m_moments.back().time(); }
+	unsigned processSize() const;
+	unsigned processStep() const;
+protected:
+	void processFrame(std::vector<float>& pcm) { calcFFT(&pcm[0]); calcTones(); }
 private:
-	double m_rate;
+	typedef Fourier (*FFTFunction)(float const* pcm, std::vector<float> const& window);
 	std::string m_id;
+	AnalyzerConfig m_config;
+	std::size_t m_fftN;  ///< FFT size in samples
+	FFTFunction m_fftFunction;  ///< da::fft specialization for m_config.fftP
 	std::vector<float> m_window;
 	Fourier m_fft;
 	std::vector<float> m_fftLastPhase;
 	Peaks m_peaks;
-	Moments m_moments;
 	mutable double m_oldfreq;
 	void calcFFT(float* pcm);
 	void calcTones();
-	void temporalMerge(Tones& tones);
 };
-
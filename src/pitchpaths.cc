@@ -0,0 +1,378 @@
+#include "pitchpaths.hh"
+#include "pitch.hh"
+#include "ffmpeg.hh"
+#include "notes.hh"
+#include "util.hh"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+namespace {
+	/// Level summed over the duration (seconds) that a path needs to be kept (level 1.0 at 512 samples per frame at 48 kHz)
+	const double MIN_SCORE = 512.0 / 48000.0;
+
+	/// Wall time between the updates of the preview pass and audio time between those of the full pass
+	const std::chrono::milliseconds PREVIEW_UPDATE_INTERVAL(250);
+	const double FULL_UPDATE_SECONDS = 10.0;
+	/// Part of the progress of analyzePitchProgressive() given to the decoding and the preview pass (the full pass takes about twice as long)
+	const double PREVIEW_PROGRESS = 1.0 / 3.0;
+
+	typedef std::vector<std::unique_ptr<PitchEngine> > Engines;
+
+	/// Low-pass filter (windowed sinc) that keeps every factor'th sample of a stream
+	class Decimator {
+	public:
+		Decimator(unsigned factor): m_factor(factor), m_taps(8 * factor + 1), m_history(m_taps.size() / 2) {
+			// Cutoff a bit below the new Nyquist frequency, the zeros in the history center the output samples
+			double cutoff = 0.45 / factor, sum = 0.0;
+			for (std::size_t i = 0; i < m_taps.size(); ++i) {
+				double x = double(i) - 0.5 * (m_taps.size() - 1);
+				double sinc = x == 0.0 ? 1.0 : std::sin(2.0 * M_PI * cutoff * x) / (M_PI * x * 2.0 * cutoff);
+				double window = 0.54 - 0.46 * std::cos(2.0 * M_PI * i / (m_taps.size() - 1));
+				m_taps[i] = sinc * window;
+				sum += m_taps[i];
+			}
+			for (float& tap: m_taps) tap /= sum;
+		}
+		/// Append the decimated output of count samples (stride apart) of input to out
+		void process(float const* input, std::size_t count, std::size_t stride, std::vector<float>& out) {
+			for (std::size_t i = 0; i < count; ++i) m_history.push_back(input[i * stride]);
+			std::size_t pos = 0;
+			for (; pos + m_taps.size() <= m_history.size(); pos += m_factor) {
+				float sum = 0.0f;
+				for (std::size_t i = 0; i < m_taps.size(); ++i) sum += m_taps[i] * m_history[pos + i];
+				out.push_back(sum);
+			}
+			m_history.erase(m_history.begin(), m_history.begin() + pos);
+		}
+	private:
+		unsigned m_factor;
+		std::vector<float> m_taps;
+		std::vector<float> m_history;  ///< Input not yet fully used
+	};
+
+	/// One engine per channel, fed with interleaved audio piece by piece
+	class ChannelEngines {
+	public:
+		ChannelEngines(PitchEngine::Type type, AnalyzerConfig const& config, unsigned rate, unsigned channels, unsigned decimation = 1):
+		  m_rate(double(rate) / decimation), m_input(channels), m_pos(), m_scanned(channels), m_frames()
+		{
+			if (channels == 0) throw std::runtime_error("No audio channels found");
+			for (unsigned ch = 0; ch < channels; ++ch) {
+				m_engines.push_back(PitchEngine::create(type, m_rate, config));
+				if (decimation > 1) m_decimators.push_back(Decimator(decimation));
+			}
+			m_paths.setFrameDuration(m_engines[0]->processStep() / m_rate);
+		}
+		/// Analyze as much as possible of the audio given so far, extended by frames interleaved samples from data
+		void process(float const* data, std::size_t frames) {
+			unsigned channels = m_engines.size();
+			for (unsigned ch = 0; ch < channels; ++ch) {
+				if (m_decimators.empty()) {
+					std::vector<float>& input = m_input[ch];
+					for (std::size_t i = 0; i < frames; ++i) input.push_back(data[i * channels + ch]);
+				} else m_decimators[ch].process(data + ch, frames, channels, m_input[ch]);
+			}
+			std::size_t size = m_engines[0]->processSize(), step = m_engines[0]->processStep();
+			for (; m_pos + size <= m_input[0].size(); m_pos += step) {
+				for (unsigned ch = 0; ch < channels; ++ch) m_engines[ch]->process(m_input[ch].begin() + m_pos);
+			}
+			// Drop the samples that no longer fit in the next frame
+			for (unsigned ch = 0; ch < channels; ++ch) m_input[ch].erase(m_input[ch].begin(), m_input[ch].begin() + m_pos);
+			m_pos = 0;
+		}
+		/// Start of the last analyzed frame (seconds)
+		double time() const { return m_engines[0]->getTime(); }
+		/// The paths of everything analyzed so far (tones that still continue end at the last frame)
+		void extract(PitchPaths& paths);
+	private:
+		/// A tone that began at frame, followed up to last
+		struct Tracked {
+			unsigned channel, frame;
+			Tone const* first;
+			Tone const* last;
+			unsigned size;
+			double score;
+		};
+		/// Follow the tones of the frames analyzed since the previous call, and store those that have ended
+		void advance();
+		bool keep(Tracked const& t) const { return t.size >= 3 && t.score * m_paths.frameDuration() > MIN_SCORE; }
+		void append(PitchPaths& paths, Tracked const& t) const;
+		double m_rate;  ///< Sample rate of the engines
+		Engines m_engines;
+		std::vector<Decimator> m_decimators;  ///< Per channel, empty if not decimating
+		std::vector<std::vector<float> > m_input;  ///< Per channel samples waiting for analysis
+		std::size_t m_pos;  ///< Start of the next frame in m_input
+		std::vector<PitchEngine::Moments::const_iterator> m_scanned;  ///< Per channel the last moment followed by advance()
+		unsigned m_frames;  ///< Number of moments followed by advance()
+		std::deque<Tracked> m_tracked;  ///< Tones not yet stored, in the order of their first frame
+		PitchPaths m_paths;  ///< The tones that have ended, kept or discarded in the order of their first frame
+	};
+
+	void ChannelEngines::advance() {
+		unsigned channels = m_engines.size();
+		for (; m_frames < m_engines[0]->getMoments().size(); ++m_frames) {
+			for (unsigned ch = 0; ch < channels; ++ch) {
+				PitchEngine::Moments const& moments = m_engines[ch]->getMoments();
+				m_scanned[ch] = m_frames ? std::next(m_scanned[ch]) : moments.begin();
+				Moment::Tones const& tones = m_scanned[ch]->m_tones;
+				for (Moment::Tones::const_iterator it = tones.begin(), itend = tones.end(); it != itend; ++it) {
+					if (it->prev) continue;  // The tone doesn't begin at this moment, skip
+					Tracked t = { ch, m_frames, &*it, &*it, 1, it->level };
+					m_tracked.push_back(t);
+				}
+			}
+		}
+		// Follow the tones to their current ends
+		for (Tracked& t: m_tracked) {
+			while (t.last->next) { t.last = t.last->next; ++t.size; t.score += t.last->level; }
+		}
+		// Tones whose last moment is not the latest can no longer continue. They are stored in the
+		// order of their first frame, so any tone waits for the tones that began before it.
+		while (!m_tracked.empty() && m_tracked.front().frame + m_tracked.front().size < m_frames) {
+			if (keep(m_tracked.front())) append(m_paths, m_tracked.front());
+			m_tracked.pop_front();
+		}
+	}
+
+	void ChannelEngines::append(PitchPaths& paths, Tracked const& t) const {
+		MusicalScale scale;
+		paths.beginPath(t.channel, t.frame);
+		for (Tone const* n = t.first; n != t.last->next; n = n->next) paths.append(scale.getNote(n->freq), level2dB(n->level));
+	}
+
+	void ChannelEngines::extract(PitchPaths& paths) {
+		advance();
+		paths = m_paths;
+		for (Tracked const& t: m_tracked) if (keep(t)) append(paths, t);
+	}
+}
+
+void analyzePitch(std::string const& file, PitchPaths& paths, PitchEngine::Type engine, AnalyzerConfig const& config, AnalyzeProgress const& progress) {
+	FFmpeg mpeg(file);
+	paths.clear();
+	double duration = mpeg.duration(); // Estimation
+	if (progress && !progress(0.0, duration)) return;
+	unsigned rate = mpeg.audioQueue.getRate();
+	unsigned channels = mpeg.audioQueue.getChannels();
+	ChannelEngines analyzers(engine, config, rate, channels);
+	// Process the entire song as it gets decoded
+	std::vector<float> data;
+	while (mpeg.audioQueue.output(data)) {
+		analyzers.process(&data[0], data.size() / channels);
+		data.clear();
+		// Update progress and check for stopping
+		double t = analyzers.time();
+		duration = std::max(duration, t + 0.01);
+		if (progress && !progress(t, duration)) break;
+	}
+	analyzers.extract(paths);
+}
+
+void analyzePitch(std::vector<float> const& pcm, unsigned rate, unsigned channels, PitchPaths& paths, PitchEngine::Type engine, AnalyzerConfig const& config, unsigned decimation) {
+	ChannelEngines analyzers(engine, config, rate, channels, decimation);
+	if (!pcm.empty()) analyzers.process(&pcm[0], pcm.size() / channels);
+	analyzers.extract(paths);
+}
+
+PreviewPass previewPass(PitchEngine::Type engine) {
+	// The YIN frame has a fixed number of samples, so at a lower rate it would get too long for vibrato
+	if (engine == PitchEngine::YIN) return PreviewPass{ AnalyzerConfig(12, 1024), 1 };
+	return PreviewPass{ AnalyzerConfig(10, 256), 4 };
+}
+
+void analyzePitchProgressive(std::string const& file, PathsUpdate const& update, PitchEngine::Type engine, AnalyzeProgress const& progress) {
+	typedef std::chrono::steady_clock Clock;
+	FFmpeg mpeg(file);
+	double duration = mpeg.duration(); // Estimation
+	if (progress && !progress(0.0, duration)) return;
+	unsigned rate = mpeg.audioQueue.getRate();
+	unsigned channels = mpeg.audioQueue.getChannels();
+	PitchPaths preview, paths;
+	// The preview follows the decoding, the decoded audio is kept for the second pass
+	PreviewPass pass = previewPass(engine);
+	ChannelEngines previewAnalyzers(engine, pass.config, rate, channels, pass.decimation);
+	std::vector<float> data;
+	data.reserve((duration + 1.0) * rate * channels);
+	std::size_t decoded = 0;
+	Clock::time_point updated = Clock::now();
+	while (mpeg.audioQueue.output(data)) {
+		previewAnalyzers.process(&data[decoded * channels], data.size() / channels - decoded);
+		decoded = data.size() / channels;
+		duration = std::max(duration, double(decoded) / rate);
+		if (progress && !progress(PREVIEW_PROGRESS * decoded / rate, duration)) { previewAnalyzers.extract(paths); update(paths); return; }
+		if (Clock::now() - updated >= PREVIEW_UPDATE_INTERVAL) {
+			previewAnalyzers.extract(paths);
+			update(paths);
+			updated = Clock::now();
+		}
+	}
+	previewAnalyzers.extract(preview);
+	paths = preview;
+	update(paths);
+	// Full resolution, each update has the preview after the part analyzed so far
+	ChannelEngines analyzers(engine, AnalyzerConfig(), rate, channels);
+	std::size_t piece = FULL_UPDATE_SECONDS * rate;
+	for (std::size_t pos = 0; pos < decoded; pos += piece) {
+		analyzers.process(&data[pos * channels], std::min(piece, decoded - pos));
+		bool last = pos + piece >= decoded;
+		analyzers.extract(paths);
+		if (!last) paths.appendFrom(preview, analyzers.time());
+		update(paths);
+		double done = last ? 1.0 : double(pos + piece) / decoded;
+		if (progress && !progress((PREVIEW_PROGRESS + (1.0 - PREVIEW_PROGRESS) * done) * duration, duration)) return;
+	}
+}
+
+int guessNote(PitchPaths const& paths, double begin, double end, int note) {
+	const unsigned scoreSz = 48;
+	double score[scoreSz] = {};
+	if (note >= 0 || note < 48) score[note] = 10.0;  // Slightly prefer the current note
+	// Score against paths
+	for (PitchPaths::const_iterator it = paths.begin(), itend = paths.end(); it != itend; ++it) {
+		// Discard paths completely outside the window
+		if (paths.endTime(*it) < begin) continue;
+		if (paths.beginTime(*it) > end) break;
+		for (PitchPaths::Fragments fragment = paths.fragments(*it); fragment.valid(); ++fragment) {
+			// Discard path points outside the window
+			if (fragment->time < begin) continue;
+			if (fragment->time > end) break;
+			unsigned n = round(fragment->note);
+			if (n < scoreSz) score[n] += 100 + fragment->level;
+		}
+	}
+	// Return the idx with best score
+	return std::max_element(score + 1, score + scoreSz) - score;
+}
+
+void PitchPaths::beginPath(unsigned channel, unsigned frame)
+{
+	m_paths.push_back(PitchPath(channel, frame, m_notes.size()));
+	m_lastCents = 0;
+}
+
+void PitchPaths::append(float note, float level)
+{
+	PitchPath& path = m_paths.back();
+	int cents = clamp<int>(round(note * 100.0f), 0, 32767);
+	m_notes.push_back(cents - m_lastCents);
+	m_levels.push_back(clamp<int>(round(level), -128, 127));
+	m_lastCents = cents;
+	++path.size;
+}
+
+void PitchPaths::discardPath()
+{
+	if (m_paths.empty()) return;
+	m_notes.resize(m_paths.back().offset);
+	m_levels.resize(m_paths.back().offset);
+	m_paths.pop_back();
+}
+
+void PitchPaths::appendFrom(PitchPaths const& other, double from)
+{
+	if (m_frameDuration <= 0.0) m_frameDuration = other.m_frameDuration;
+	for (const_iterator it = other.begin(); it != other.end(); ++it) {
+		if (other.endTime(*it) < from) continue;
+		std::vector<PitchFragment> points;
+		for (Fragments f = other.fragments(*it); f.valid(); ++f) points.push_back(*f);
+		unsigned first = std::max(std::ceil(from / m_frameDuration), std::round(points.front().time / m_frameDuration));
+		unsigned last = std::round(points.back().time / m_frameDuration);
+		if (first > last) continue;
+		beginPath(it->channel, first);
+		std::size_t i = 0;
+		for (unsigned frame = first; frame <= last; ++frame) {
+			double t = frame * m_frameDuration;
+			while (i + 2 < points.size() && points[i + 1].time <= t) ++i;
+			PitchFragment const& a = points[i];
+			PitchFragment const& b = points[std::min(i + 1, points.size() - 1)];
+			double w = b.time > a.time ? clamp((t - a.time) / (b.time - a.time), 0.0, 1.0) : 0.0;
+			append(a.note + w * (b.note - a.note), a.level + w * (b.level - a.level));
+		}
+	}
+}
+
+std::size_t PitchPaths::memoryUsage() const
+{
+	return m_paths.capacity() * sizeof(PitchPath) + m_notes.capacity() * sizeof(int16_t) + m_levels.capacity() * sizeof(int8_t);
+}
+
+namespace {
+	template <typename T> void writeRaw(std::ostream& os, T const& value) { os.write(reinterpret_cast<char const*>(&value), sizeof(T)); }
+	template <typename T> void readRaw(std::istream& is, T& value) { is.read(reinterpret_cast<char*>(&value), sizeof(T)); }
+	template <typename T> void writeVector(std::ostream& os, std::vector<T> const& vec) {
+		writeRaw<uint32_t>(os, vec.size());
+		if (!vec.empty()) os.write(reinterpret_cast<char const*>(&vec[0]), vec.size() * sizeof(T));
+	}
+	template <typename T> void readVector(std::istream& is, std::vector<T>& vec) {
+		uint32_t size = 0;
+		readRaw(is, size);
+		vec.resize(size);
+		if (size) is.read(reinterpret_cast<char*>(&vec[0]), size * sizeof(T));
+	}
+}
+
+void PitchPaths::write(std::ostream& os) const
+{
+	writeRaw(os, m_frameDuration);
+	writeVector(os, m_paths);
+	writeVector(os, m_notes);
+	writeVector(os, m_levels);
+}
+
+void PitchPaths::read(std::istream& is)
+{
+	readRaw(is, m_frameDuration);
+	readVector(is, m_paths);
+	readVector(is, m_notes);
+	readVector(is, m_levels);
+	if (!is) { clear(); throw std::runtime_error("Invalid pitch path data"); }
+	for (const_iterator it = m_paths.begin(); it != m_paths.end(); ++it) {
+		if (it->offset + it->size > m_notes.size() || m_notes.size() != m_levels.size()) {
+			clear();
+			throw std::runtime_error("Corrupted pitch path data");
+		}
+	}
+}
+
+void PitchPaths::writeJson(std::ostream& os) const
+{
+	os << "{\"frameDuration\":" << m_frameDuration << ",\"paths\":[";
+	for (const_iterator it = m_paths.begin(); it != m_paths.end(); ++it) {
+		if (it != m_paths.begin()) os << ',';
+		os << "\n{\"channel\":" << it->channel << ",\"begin\":" << beginTime(*it) << ",\"notes\":[";
+		unsigned i = 0;
+		for (Fragments f = fragments(*it); f.valid(); ++f) os << (i++ ? "," : "") << f->note;
+		os << "],\"levels\":[";
+		for (i = 0; i < it->size; ++i) os << (i ? "," : "") << int(m_levels[it->offset + i]);
+		os << "]}";
+	}
+	os << "\n]}\n";
+}
+
+PitchPaths::Fragments::Fragments(PitchPaths const& paths, PitchPath const& path)
+	: m_paths(paths), m_frame(path.frame), m_pos(path.offset), m_end(path.offset + path.size), m_cents(), m_fragment(0.0f, 0.0f, 0.0f)
+{
+	decode();
+}
+
+PitchPaths::Fragments& PitchPaths::Fragments::operator++()
+{
+	++m_pos;
+	++m_frame;
+	decode();
+	return *this;
+}
+
+void PitchPaths::Fragments::decode()
+{
+	if (!valid()) return;
+	m_cents += m_paths.m_notes[m_pos];
+	m_fragment.time = m_frame * m_paths.m_frameDuration;
+	m_fragment.note = m_cents / 100.0f;
+	m_fragment.level = m_paths.m_levels[m_pos];
+}
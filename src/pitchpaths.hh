@@ -0,0 +1,127 @@
+#pragma once
+
+#include "pitch.hh"
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/// Decoded point of a pitch path
+struct PitchFragment {
+	float time, note, level;  // seconds, MIDI note, dB
+	PitchFragment(float time, float note, float level): time(time), note(note), level(level) {}
+};
+
+/// A continuous tone, stored quantized in the shared buffers of PitchPaths
+struct PitchPath {
+	unsigned channel;
+	unsigned frame;  ///< Analyzer frame of the first fragment
+	unsigned offset;  ///< Position of the first fragment in the shared buffers
+	unsigned size;  ///< Number of fragments
+	PitchPath(unsigned channel = 0, unsigned frame = 0, unsigned offset = 0): channel(channel), frame(frame), offset(offset), size() {}
+};
+
+/**
+ * @brief Compact storage for all pitch paths of a song.
+ *
+ * Fragment times are implicit (one fragment per analyzer frame), notes are
+ * stored as cents delta-coded against the previous fragment of the same path
+ * and levels as whole decibels. All paths share the same two buffers, which
+ * are also written as such by write() for caching on disk.
+ */
+class PitchPaths {
+public:
+	typedef std::vector<PitchPath> Paths;
+	typedef Paths::const_iterator const_iterator;
+
+	/// Sequential decoder for the fragments of one path
+	class Fragments {
+	public:
+		Fragments(PitchPaths const& paths, PitchPath const& path);
+		bool valid() const { return m_pos < m_end; }
+		PitchFragment const& operator*() const { return m_fragment; }
+		PitchFragment const* operator->() const { return &m_fragment; }
+		Fragments& operator++();
+	private:
+		void decode();
+		PitchPaths const& m_paths;
+		unsigned m_frame;
+		unsigned m_pos, m_end;
+		int m_cents;
+		PitchFragment m_fragment;
+	};
+
+	PitchPaths(double frameDuration = 0.0): m_frameDuration(frameDuration), m_lastCents() {}
+	void clear() { m_paths.clear(); m_notes.clear(); m_levels.clear(); }
+	/// Start a new path at the given analyzer frame
+	void beginPath(unsigned channel, unsigned frame);
+	/// Append the next fragment to the path being built
+	void append(float note, float level);
+	/// Drop the most recently added path (e.g. when it turns out too weak)
+	void discardPath();
+	/// Append the parts of the paths of other from time from (seconds) on, interpolated to this frame duration
+	void appendFrom(PitchPaths const& other, double from);
+
+	bool empty() const { return m_paths.empty(); }
+	std::size_t size() const { return m_paths.size(); }
+	const_iterator begin() const { return m_paths.begin(); }
+	const_iterator end() const { return m_paths.end(); }
+	Fragments fragments(PitchPath const& path) const { return Fragments(*this, path); }
+	double beginTime(PitchPath const& path) const { return path.frame * m_frameDuration; }
+	double endTime(PitchPath const& path) const { return (path.frame + path.size - 1) * m_frameDuration; }
+	double frameDuration() const { return m_frameDuration; }
+	void setFrameDuration(double seconds) { m_frameDuration = seconds; }
+	/// Approximate memory use in bytes
+	std::size_t memoryUsage() const;
+
+	/// Binary serialization of the packed buffers (native byte order)
+	void write(std::ostream& os) const;
+	void read(std::istream& is);
+	/// JSON export: {"frameDuration": s, "paths": [{"channel": c, "begin": s, "notes": [...], "levels": [...]}, ...]}
+	void writeJson(std::ostream& os) const;
+
+private:
+	double m_frameDuration;  ///< Seconds between consecutive fragments
+	Paths m_paths;
+	std::vector<int16_t> m_notes;  ///< Note delta in cents
+	std::vector<int8_t> m_levels;  ///< Level in dB
+	int m_lastCents;  ///< Last quantized note of the path being built
+};
+
+/// Called during analysis with the analyzed position and the (estimated) duration in seconds; returning false stops the analysis early
+typedef std::function<bool (double position, double duration)> AnalyzeProgress;
+
+/**
+ * Decode the audio of file and detect the tones of each channel into paths with the given engine and resolution.
+ * If stopped through progress, paths contain what was analyzed until then.
+ * Throws on decoding errors.
+ */
+void analyzePitch(std::string const& file, PitchPaths& paths, PitchEngine::Type engine = PitchEngine::HARMONIC,
+  AnalyzerConfig const& config = AnalyzerConfig(), AnalyzeProgress const& progress = AnalyzeProgress());
+/// Detect the tones of already decoded interleaved samples into paths, analyzing every decimation'th sample (low-pass filtered)
+void analyzePitch(std::vector<float> const& pcm, unsigned rate, unsigned channels, PitchPaths& paths, PitchEngine::Type engine = PitchEngine::HARMONIC,
+  AnalyzerConfig const& config = AnalyzerConfig(), unsigned decimation = 1);
+
+/// Resolution of the preview pass of analyzePitchProgressive(), one frame per two default resolution frames
+struct PreviewPass {
+	AnalyzerConfig config;
+	unsigned decimation;  ///< Analyze every decimation'th sample
+};
+PreviewPass previewPass(PitchEngine::Type engine);
+
+/// Receives the paths analyzed so far, which it may take (e.g. by swap)
+typedef std::function<void (PitchPaths& paths)> PathsUpdate;
+
+/**
+ * Analyze file in two passes, calling update with the paths whenever there is more to show.
+ * A coarse preview pass (see previewPass()) follows the decoding, and once the file is
+ * decoded the default resolution pass replaces the preview piece by piece. The position
+ * given to progress covers both passes: the preview advances it to a third of the duration
+ * and the second pass from there to the end. Throws on decoding errors.
+ */
+void analyzePitchProgressive(std::string const& file, PathsUpdate const& update, PitchEngine::Type engine = PitchEngine::HARMONIC,
+  AnalyzeProgress const& progress = AnalyzeProgress());
+
+/// The note (0..47) sung most strongly between begin and end (seconds), preferring initial
+int guessNote(PitchPaths const& paths, double begin, double end, int initial);
@@ -0,0 +1,87 @@
+#include "pitchyin.hh"
+
+#include "libda/fft.hpp"
+#include <algorithm>
+#include <cmath>
+
+static const unsigned YIN_P = 12;  // Autocorrelation FFT size setting, must fit YIN_N samples
+static const std::size_t YIN_FFT_N = 1 << YIN_P;
+static const std::size_t YIN_N = 2048;  // Frame size in samples
+
+// Singing range, the lowest frequency also limits the longest period to half a frame
+static const double YIN_MINFREQ = 60.0;
+static const double YIN_MAXFREQ = 1500.0;
+static const double YIN_THRESHOLD = 0.15;  // Normalized difference below which the frame is periodic
+static const double YIN_MINLEVEL = 1e-3;  // RMS level below which frames are not analyzed (-60 dB)
+
+YinAnalyzer::YinAnalyzer(double rate, unsigned step):
+  PitchEngine(rate),
+  m_step(step),
+  m_minLag(std::max(2.0, rate / YIN_MAXFREQ)),
+  m_maxLag(std::min<double>(YIN_N / 2, rate / YIN_MINFREQ)),
+  m_fft(YIN_FFT_N),
+  m_diff(m_maxLag + 2)
+{}
+
+unsigned YinAnalyzer::processSize() const { return YIN_N; }
+unsigned YinAnalyzer::processStep() const { return m_step; }
+
+void YinAnalyzer::difference(std::vector<float> const& pcm) {
+	const std::size_t w = YIN_N - m_maxLag - 1;  // Integration window
+	// Cross-correlate the first w samples with the whole frame. Both are real, so they
+	// are transformed together as the real and the imaginary parts of one FFT.
+	for (std::size_t i = 0; i < YIN_FFT_N; ++i) {
+		m_fft[i] = std::complex<float>(i < w ? pcm[i] : 0.0f, i < YIN_N ? pcm[i] : 0.0f);
+	}
+	da::fft<YIN_P>(&m_fft[0]);
+	for (std::size_t k = 0; k <= YIN_FFT_N / 2; ++k) {
+		std::complex<float> z = m_fft[k], zc = std::conj(m_fft[(YIN_FFT_N - k) % YIN_FFT_N]);
+		std::complex<float> a = 0.5f * (z + zc), b = std::complex<float>(0.0f, -0.5f) * (z - zc);
+		// Conjugated for the inverse transform below (the correlation spectrum is Hermitian)
+		std::complex<float> p = std::conj(std::conj(a) * b);
+		m_fft[k] = p;
+		m_fft[(YIN_FFT_N - k) % YIN_FFT_N] = std::conj(p);
+	}
+	da::fft<YIN_P>(&m_fft[0]);  // Inverse by the conjugates, only the real part is needed
+	// d(tau) = sum (x[j] - x[j + tau])^2 = energy of x[0..w) + energy of x[tau..tau+w) - 2 r(tau)
+	double e0 = 0.0;
+	for (std::size_t j = 0; j < w; ++j) e0 += pcm[j] * pcm[j];
+	double etau = e0;
+	for (std::size_t tau = 0; tau <= m_maxLag; ++tau) {
+		if (tau > 0) etau += pcm[tau + w - 1] * pcm[tau + w - 1] - pcm[tau - 1] * pcm[tau - 1];
+		m_diff[tau] = std::max(0.0, e0 + etau - 2.0 * m_fft[tau].real() / YIN_FFT_N);
+	}
+}
+
+void YinAnalyzer::processFrame(std::vector<float>& pcm) {
+	Tones tones;
+	double energy = 0.0;
+	for (std::size_t i = 0; i < YIN_N; ++i) energy += pcm[i] * pcm[i];
+	double rms = std::sqrt(energy / YIN_N);
+	if (rms >= YIN_MINLEVEL) {
+		difference(pcm);
+		// Cumulative mean normalized difference (in place)
+		double sum = 0.0;
+		m_diff[0] = 1.0;
+		for (std::size_t tau = 1; tau <= m_maxLag; ++tau) {
+			sum += m_diff[tau];
+			m_diff[tau] = sum > 0.0 ? m_diff[tau] * tau / sum : 1.0;
+		}
+		// The first dip below the threshold (the shortest period, so no subharmonics)
+		std::size_t tau = m_minLag;
+		while (tau < m_maxLag && m_diff[tau] >= YIN_THRESHOLD) ++tau;
+		if (tau < m_maxLag) {
+			while (tau + 1 < m_maxLag && m_diff[tau + 1] < m_diff[tau]) ++tau;
+			// Parabolic interpolation of the minimum
+			double prev = m_diff[tau - 1], cur = m_diff[tau], next = m_diff[tau + 1];
+			double denom = prev - 2.0 * cur + next;
+			double period = tau + (denom > 0.0 ? 0.5 * (prev - next) / denom : 0.0);
+			Tone tone;
+			tone.freq = m_rate / period;
+			tone.level = rms;
+			tone.harmonics[0] = rms;
+			tones.push_back(tone);
+		}
+	}
+	temporalMerge(tones);
+}
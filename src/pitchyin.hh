@@ -0,0 +1,30 @@
+#pragma once
+
+#include "pitch.hh"
+#include <complex>
+#include <vector>
+
+/**
+ * @brief YIN pitch detection (de Cheveigné & Kawahara 2002).
+ *
+ * Finds the period of a single voice from the cumulative mean normalized
+ * difference function, whose autocorrelation part is computed by FFT.
+ * At most one tone per moment, so it only suits monophonic input such as
+ * isolated vocal tracks, but there it does not confuse harmonics with the
+ * fundamental the way the harmonic Analyzer can.
+ */
+class YinAnalyzer: public PitchEngine {
+public:
+	YinAnalyzer(double rate, unsigned step = 512);
+	unsigned processSize() const;
+	unsigned processStep() const;
+protected:
+	void processFrame(std::vector<float>& pcm);
+private:
+	/// Difference function d(tau) of pcm for tau = 0..m_maxLag into m_diff
+	void difference(std::vector<float> const& pcm);
+	unsigned m_step;
+	unsigned m_minLag, m_maxLag;  ///< Period range (samples)
+	std::vector<std::complex<float> > m_fft;
+	std::vector<double> m_diff;
+};
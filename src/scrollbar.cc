@@ -34,7 +34,8 @@ void ScrollBar::resizeEvent(QResizeEvent * event) {
 void ScrollBar::paintEvent(QPaintEvent* event) {
 	//QScrollBar::paintEvent(event);
 
-	const auto range = std::max(1, maximum() - minimum());
+	// In double, the range of a long song in pixels at full zoom times the width overflows int
+	const double range = std::max(1, maximum() - minimum());
 	
 	QPainter painter(this);
 
@@ -42,16 +43,16 @@ void ScrollBar::paintEvent(QPaintEvent* event) {
 	painter.setPen(QPen(Qt::gray,1));
 
 	if(orientation() == Qt::Horizontal) {
-		const auto viewWidth = width();
-		const auto w = viewWidth * viewWidth / range;
-		const auto x = value() * (width() - w) / range;
+		const double viewWidth = width();
+		const double w = viewWidth * viewWidth / range;
+		const double x = value() * (viewWidth - w) / range;
 		
-		painter.drawRect(x, y(), w - 1, height() - 1);
+		painter.drawRect(QRectF(x, y(), w - 1, height() - 1));
 	} else {
-		const auto viewHeight = height();
-		const auto h = viewHeight * viewHeight / range;
-		const auto y = value() * (height() - h) / range;
+		const double viewHeight = height();
+		const double h = viewHeight * viewHeight / range;
+		const double y = value() * (viewHeight - h) / range;
 		
-		painter.drawRect(x(), y, width() - 1, h - 1);
+		painter.drawRect(QRectF(x(), y, width() - 1, h - 1));
 	}
 }
@@ -85,13 +85,18 @@ Song::Status Song::status(double time) {
 	return NORMAL;
 }
 
+namespace {
+	bool sectionBeginLessThan(double pos, Song::SongSection const& section) { return pos < section.begin; }
+	bool sectionBeginLessThanPos(Song::SongSection const& section, double pos) { return section.begin < pos; }
+}
+
 bool Song::getNextSection(double pos, SongSection &section) {
 	if (songsections.empty()) return false;
-	for (std::vector<Song::SongSection>::iterator it= songsections.begin(); it != songsections.end(); ++it) {
-		if (it->begin > pos) {
-			section = *it;
-			return true;
-		}
+	// Sections are ordered by begin time
+	SongSections::const_iterator it = std::upper_bound(songsections.begin(), songsections.end(), pos, sectionBeginLessThan);
+	if (it != songsections.end()) {
+		section = *it;
+		return true;
 	}
 	// returning false here will jump forward 5s (see screen_sing.cc)
 	return false;
@@ -99,12 +104,11 @@ bool Song::getNextSection(double pos, SongSection &section) {
 
 bool Song::getPrevSection(double pos, SongSection &section) {
 	if (songsections.empty()) return false;
-	for (std::vector<Song::SongSection>::reverse_iterator it= songsections.rbegin(); it != songsections.rend(); it++) {
-		// subtract 1 second so we can jump across a section
-		if (it->begin < pos - 1.0) {
-			section = *it;
-			return true;
-		}
+	// subtract 1 second so we can jump across a section
+	SongSections::const_iterator it = std::lower_bound(songsections.begin(), songsections.end(), pos - 1.0, sectionBeginLessThanPos);
+	if (it != songsections.begin()) {
+		section = *--it;
+		return true;
 	}
 	// returning false here will jump backwards by 5s (see screen_sing.cc)
 	return false;
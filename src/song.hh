@@ -153,7 +153,7 @@ class Song {
 		SongSection(QString const& name, const double begin): name(name), begin(begin) {}
 	};
 	typedef std::vector<SongSection> SongSections;
-	SongSections songsections; ///< vector of song sections
+	SongSections songsections; ///< vector of song sections, ordered by begin time
 	bool getNextSection(double pos, SongSection &section);
 	bool getPrevSection(double pos, SongSection &section);
 };
@@ -1,5 +1,4 @@
 #include "songparser.hh"
-#include "textcodecselector.hh"
 #include <QFile>
 #include <QFileInfo>
 #include <algorithm>
@@ -13,6 +12,7 @@ namespace SongParserUtil {
 	}
 }
 
+CodecSelector SongParser::codecSelector;
 
 /// constructor
 SongParser::SongParser(Song& s):
@@ -38,7 +38,7 @@ SongParser::SongParser(Song& s):
 	if (finfo.size() < 10 || finfo.size() > 100000) throw SongParserException("Does not look like a song file (wrong size)", 1, true);
 
 	// Determine encoding
-	QString data = TextCodecSelector::readAllAndHandleEncoding(file);
+	QString data = decodeText(file.readAll(), codecSelector);
 	file.close();
 	// Add a newline to the end to make sure our parsing doesn't skip the last line
 	data += "\n";
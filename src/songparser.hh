@@ -1,6 +1,7 @@
 #pragma once
 
 #include "song.hh"
+#include "textencoding.hh"
 #include <QTextStream>
 
 namespace SongParserUtil {
@@ -14,6 +15,9 @@ class SongParser {
 	/// constructor
 	SongParser(Song& s);
 
+	/// Asks for the encoding of song files that cannot be detected (the GUI shows a dialog, none by default)
+	static CodecSelector codecSelector;
+
 	static bool looksLikeSongFile(QString const& data) {
 		return txtCheck(data) || xmlCheck(data) || iniCheck(data) || smCheck(data) || lrcCheck(data);
 	}
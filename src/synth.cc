@@ -2,113 +2,271 @@
 #include <fstream>
 #include <string>
 #include <cmath>
+#include <cstring>
+#include <thread>
 #include <QDebug>
-#include <QElapsedTimer>
+#include <QAudioDeviceInfo>
 #include "synth.hh"
+#include "util.hh"
 
 #ifndef M_PI
 	#define M_PI 3.141592653589793
 #endif
 
 
-void Synth::tick(qint64 pos, qreal playbackRate, const SynthNotes& notes) {
+namespace {
+	const double resyncThreshold = 0.2; ///< Larger clock errors (seconds) are seeks
+	const double clockCorrection = 0.1; ///< Fraction of a small clock error corrected per tick
+	const double attackTime = 0.005; ///< Envelope attack (seconds)
+	const double decayTime = 0.04; ///< Envelope decay (seconds)
+	const float sustainLevel = 0.8f; ///< Envelope sustain level
+	const double releaseTime = 0.02; ///< Envelope release at the end of the note (seconds)
+	const int attackSamples = attackTime * Synth::SampleRate;
+	const int releaseSamples = releaseTime * Synth::SampleRate;
+	const double renderChunk = 10.0; ///< Length of the pieces rendered in parallel offline (seconds)
+	const int tableBits = 10; ///< Wavetable size 1 << tableBits
+	const int tableSize = 1 << tableBits;
+	const int bufferSamples = Synth::SampleRate / 10; ///< Audio device buffer (100 ms)
+
+	/// Mono 16 bit PCM, as supported by the default device
+	QAudioFormat synthFormat() {
+		QAudioFormat format;
+		format.setChannelCount(1);
+		format.setSampleRate(Synth::SampleRate);
+		format.setSampleSize(16);
+		format.setSampleType(QAudioFormat::SignedInt);
+		format.setByteOrder(QAudioFormat::LittleEndian);
+		format.setCodec("audio/pcm");
+
+		QAudioDeviceInfo info(QAudioDeviceInfo::defaultOutputDevice());
+		if (!info.isFormatSupported(format)) {
+			qWarning() << "Synth output format not supported, trying nearest";
+			format = info.nearestFormat(format);
+		}
+		return format;
+	}
+
+	/// Single cycles of the beep timbre for the 12 pitch classes (a few harmonics balanced by pitch class).
+	/// Only the 1st, 2nd and 4th harmonics are present. At SampleRate the 4th harmonic stays below the Nyquist
+	/// frequency for notes up to about 2.7 kHz (E7), well above sung notes; higher notes alias.
+	struct Wavetables {
+		Wavetables() {
+			for (int pc = 0; pc < 12; ++pc) {
+				double d = (pc + 1) / 13.0;
+				for (int i = 0; i <= tableSize; ++i) { // The extra sample is for interpolation
+					double phase = 2.0 * M_PI * i / tableSize;
+					table[pc][i] = d * 0.2 * std::sin(phase) + 0.2 * std::sin(2 * phase) + (1.0 - d) * 0.2 * std::sin(4 * phase);
+				}
+			}
+		}
+		float table[12][tableSize + 1];
+	};
+
+	const Wavetables& wavetables() {
+		static const Wavetables tables; // Built once, shared by all voices
+		return tables;
+	}
+
+}
+
+
+Synth::Voice::Voice(int note, quint64 beginSample, quint64 endSample, unsigned rate)
+	: begin(beginSample), end(endSample), table(wavetables().table[(note % 12 + 12) % 12]), phase(),
+	step(MusicalScale().getNoteFreq(note) / rate * 4294967296.0),
+	attack(attackTime * rate), decay(decayTime * rate), release(releaseTime * rate)
+{}
+
+float Synth::Voice::envelope(quint64 offset) const
+{
+	if (offset < attack) return float(offset) / attack;
+	offset -= attack;
+	if (offset < decay) return 1.0f - (1.0f - sustainLevel) * offset / decay;
+	return sustainLevel;
+}
+
+void Synth::Voice::render(float *out, quint64 first, quint64 last)
+{
+	// The envelope is linear between these points (relative to begin): attack, decay, sustain, release
+	const quint64 length = end - begin;
+	const quint64 releaseBegin = length > release ? length - release : 0;
+	const quint64 points[] = { 0, std::min<quint64>(attack, releaseBegin), std::min<quint64>(attack + decay, releaseBegin), releaseBegin, length };
+	const float fracScale = 1.0f / (1 << (32 - tableBits));
+	for (int seg = 0; seg < 4; ++seg) {
+		quint64 s = points[seg], e = points[seg + 1];
+		// Intersect with the requested samples
+		quint64 from = std::max(s, first - begin), to = std::min(e, last - begin);
+		if (from >= to) continue;
+		float g0 = envelope(s), g1 = seg < 3 ? envelope(e) : 0.0f;
+		float slope = (g1 - g0) / (e - s);
+		float gain = g0 + slope * (from - s);
+		float *o = out + (begin + from - first);
+		quint32 ph = phase, st = step;
+		// Table lookup with linear interpolation (no branches, so the compiler can vectorize)
+		for (quint64 i = 0, n = to - from; i < n; ++i) {
+			quint32 idx = ph >> (32 - tableBits);
+			float frac = (ph & ((1u << (32 - tableBits)) - 1)) * fracScale;
+			o[i] += gain * (table[idx] + frac * (table[idx + 1] - table[idx]));
+			gain += slope;
+			ph += st;
+		}
+		phase = ph;
+	}
+}
+
+Synth::Synth(QObject *parent)
+	: QIODevice(parent), m_notes(std::make_shared<const SynthNotes>()), m_cursor(-1),
+	m_anchorSample(), m_anchorTime(), m_rate(1.0), m_scheduled(), m_synced(), m_rendered(),
+	m_errorSum(), m_errorCount()
+{
+	open(QIODevice::ReadOnly);
+	m_output = new QAudioOutput(synthFormat(), this);
+	m_output->setBufferSize(bufferSamples * 2);
+	m_output->start(this); // Pull mode: the device reads the stream as it needs it
+}
+
+void Synth::setNotes(const SynthNotes& notes) {
+	std::atomic_store(&m_notes, SynthNotesSnapshot(std::make_shared<const SynthNotes>(notes)));
+}
+
+void Synth::tick(qint64 pos, qreal playbackRate) {
+	double now = playedSample();
 	QMutexLocker locker(&m_mutex);
-	m_pos = pos / 1000.0;
+	double time = pos / 1000.0;
+	double error = time - sampleToTime(now);
+	if (!m_synced || std::abs(error) > resyncThreshold) {
+		// Start or seek: lock the clock to the reported position and start over from there
+		m_voices.clear();
+		m_scheduled = time;
+		m_cursor = -1;
+		m_anchorTime = time;
+		m_synced = true;
+	} else {
+		// The reported position is only accurate to some milliseconds, so follow it smoothly
+		m_errorSum += std::abs(error);
+		++m_errorCount;
+		m_stats.maxClockError = std::max(m_stats.maxClockError, std::abs(error));
+		m_anchorTime = sampleToTime(now) + clockCorrection * error;
+	}
+	m_anchorSample = now;
 	m_rate = playbackRate;
-	m_notes = notes;
-	if (m_notes.isEmpty()) m_quit = true;
-
-	if (isRunning()) m_condition.wakeOne();
-	else start();
 }
 
 void Synth::stop() {
+	m_output->stop();
+	close();
+}
+
+Synth::Stats Synth::stats() const {
+	double played = playedSample();
 	QMutexLocker locker(&m_mutex);
-	m_quit = true;
-	m_condition.wakeOne();
+	Stats st = m_stats;
+	st.latency = std::max(0.0, (m_rendered - played) / SampleRate);
+	st.jitter = m_errorCount ? m_errorSum / m_errorCount : 0.0;
+	return st;
+}
+
+double Synth::playedSample() const {
+	return m_output->processedUSecs() * 1e-6 * SampleRate;
+}
+
+qint64 Synth::bytesAvailable() const {
+	// Endless stream, there is always another buffer full
+	return bufferSamples * 2 + QIODevice::bytesAvailable();
+}
+
+void Synth::schedule(quint64 until) {
+	SynthNotesSnapshot notes = std::atomic_load(&m_notes);
+	if (notes != m_cursorNotes || m_cursor < 0) {
+		// New notes or a seek: continue from the first note not started yet
+		m_cursorNotes = notes;
+		SynthNote target;
+		target.begin = m_scheduled;
+		m_cursor = std::lower_bound(notes->begin(), notes->end(), target) - notes->begin();
+	}
+	double untilTime = sampleToTime(until);
+	for (; m_cursor < notes->size() && (*notes)[m_cursor].begin < untilTime; ++m_cursor) {
+		const SynthNote *it = &(*notes)[m_cursor];
+		double begin = timeToSample(it->begin);
+		quint64 first = m_rendered;
+		if (begin >= m_rendered) first = begin;
+		else ++m_stats.lateNotes; // Not dropped, but starts now
+		quint64 last = std::max(timeToSample(it->begin + it->length), double(first + attackSamples + releaseSamples));
+		m_voices.push_back(Voice(it->note, first, last));
+		++m_stats.notes;
+	}
+	m_scheduled = std::max(m_scheduled, untilTime);
+}
+
+qint64 Synth::readData(char *data, qint64 maxSize) {
+	QMutexLocker locker(&m_mutex);
+	const qint64 samples = maxSize / 2;
+	const quint64 begin = m_rendered, end = m_rendered + samples;
+	if (m_synced) schedule(end);
+
+	// Mix the voices sounding in this block
+	std::vector<float> mix(samples, 0.0f);
+	for (std::vector<Voice>::iterator v = m_voices.begin(); v != m_voices.end(); ++v) {
+		quint64 first = std::max(begin, v->begin), last = std::min(end, v->end);
+		if (first < last) v->render(&mix[first - begin], first, last);
+	}
+	// Drop the finished ones
+	std::vector<Voice>::iterator out = m_voices.begin();
+	for (std::vector<Voice>::iterator v = m_voices.begin(); v != m_voices.end(); ++v)
+		if (v->end > end) *out++ = *v;
+	m_voices.erase(out, m_voices.end());
+
+	// Convert float to 16-bit integer
+	for (qint64 i = 0; i < samples; ++i) {
+		qint16 svalue = clamp(mix[i], -1.0f, 32767.0f / 32768.0f) * 32768;
+		std::memcpy(data + 2 * i, &svalue, 2);
+	}
+	m_rendered = end;
+	return samples * 2;
 }
 
 void Synth::createBuffer(QByteArray &buffer, int note, double length) {
 	// This is simple beep, so we use mono and lowish sample rate
 	// --> quick to create and small memory footprint
 	// Going to 8 bits seems to create weird samples on Windows though
-	//std::string header = writeWavHeader(16, 1, SampleRate, length * SampleRate);
-	//buffer = QByteArray(header.c_str(), header.size());
-	const int bytesPerSample = 2;
 	const quint64 samples = length * SampleRate;
-	buffer.clear();
-	buffer.reserve(samples * bytesPerSample);
-	double d = (note + 1) / 13.0;
-	double freq = MusicalScale().getNoteFreq(note + 12);
-	double phase = 0;
-	// Synthesize tones
-	for (size_t i = 0; i < samples; ++i) {
-		float fvalue = d * 0.2 * std::sin(phase) + 0.2 * std::sin(2 * phase) + (1.0 - d) * 0.2 * std::sin(4 * phase);
-		phase += 2.0 * M_PI * freq / SampleRate;
-
-		// Convert float to 16-bit integer and push to buffer
-		qint16 svalue = fvalue * 32768;
-		char* value = reinterpret_cast<char*>(&svalue);
-		buffer.push_back(value[0]);
-		buffer.push_back(value[1]);
-	}
+	std::vector<float> mix(samples, 0.0f);
+	Voice voice(note + 12, 0, samples); // The piano gives pitch classes, played an octave up
+	voice.render(mix.data(), 0, samples);
 
-	//std::ofstream of("/tmp/wavdump.wav");
-	//of.write(buf.data(), buf.size());
-}
-
-void Synth::run() {
-	calcNext();
-	while (!m_quit) {
-		m_mutex.lock();
-		// Wait here until wake up or time out
-		if (m_condition.wait(&m_mutex, m_delay * 1000)) {
-			// We were woken up, so let's see if an update is in order
-			m_mutex.unlock();
-			if (m_quit) break;
-			calcNext();
-
-		} else {
-			// Time-out: time to play the music
-			m_mutex.unlock();
-			if (m_quit) break;
-			emit playBuffer(m_soundData[m_curBuffer]);
-			m_curBuffer = (m_curBuffer+1) % 2;
-			// Slightly hacky stuff follows:
-			// We advance the time a bit to make sure we are over the note beginning.
-			// Then cache the next note, but put longer delay (which will be corrected
-			// with the next tick) so that we don't accidentally play wrong note(
-			// in case we advanced the time too much).
-			m_pos += 0.2;
-			calcNext();
-			m_delay = std::max(m_delay, 1.0);
-		}
+	// Convert float to 16-bit integer
+	buffer.resize(samples * 2);
+	for (quint64 i = 0; i < samples; ++i) {
+		qint16 svalue = clamp(mix[i], -1.0f, 32767.0f / 32768.0f) * 32768;
+		std::memcpy(buffer.data() + 2 * i, &svalue, 2);
 	}
 }
 
-void Synth::calcNext() {
-	QElapsedTimer timer; timer.start();
-	SynthNote n;
-	{
-		QMutexLocker locker(&m_mutex);
-		SynthNotes::const_iterator it = m_notes.begin();
-		while (it != m_notes.end() && it->begin < m_pos) ++it;
-		if (it == m_notes.end()) { m_delay = 1000.0; return; }
-		n = *it;
-	}
-
-	m_delay = n.begin - m_pos;
-	if (n.begin != m_noteBegin) {
-		// Need to create a new buffer
-		m_noteBegin = n.begin;
-		createBuffer(m_soundData[m_curBuffer], n.note % 12, n.length / m_rate);
-	}
-	// Compensate for the time spent in this function
-	m_delay -= timer.elapsed() / 1000.0;
-	if (m_delay <= 0.001) m_delay = 0.001;
+std::vector<float> Synth::render(const SynthNotes& notes, unsigned rate, std::size_t samples) {
+	std::vector<float> mix(samples, 0.0f);
+	const std::size_t chunk = renderChunk * rate;
+	// Each thread renders every nth chunk, starting the voices that overlap it at their phase there
+	auto renderChunks = [&](unsigned first, unsigned stride) {
+		for (std::size_t begin = first * chunk; begin < samples; begin += stride * chunk) {
+			const std::size_t end = std::min(samples, begin + chunk);
+			for (const SynthNote& n: notes) {
+				const quint64 noteBegin = std::max(0.0, n.begin * rate);
+				if (noteBegin >= end) break; // Ordered by begin
+				Voice voice(n.note, noteBegin, noteBegin + std::max(n.length, attackTime + releaseTime) * rate, rate);
+				quint64 from = std::max<quint64>(begin, voice.begin), to = std::min<quint64>(end, voice.end);
+				if (from >= to) continue;
+				voice.seek(from);
+				voice.render(&mix[from], from, to);
+			}
+		}
+	};
+	unsigned threads = std::max(1u, std::min<unsigned>(std::thread::hardware_concurrency(), samples / chunk + 1));
+	std::vector<std::thread> workers;
+	for (unsigned t = 1; t < threads; ++t) workers.push_back(std::thread(renderChunks, t, threads));
+	renderChunks(0, threads);
+	for (std::thread& w: workers) w.join();
+	return mix;
 }
 
-
 std::string Synth::writeWavHeader(unsigned bits, unsigned ch, unsigned sr, unsigned samples) {
 	std::ostringstream out;
 	unsigned bps = ch * bits / 8; // Bytes per sample
@@ -137,21 +295,7 @@ BufferPlayer::BufferPlayer(QObject *parent)
 : QObject(parent)
 {
 	m_buffer = new QBuffer(this);
-
-	QAudioFormat format;
-	format.setChannelCount(1);
-	format.setSampleRate(Synth::SampleRate);
-	format.setSampleSize(16);
-	format.setSampleType(QAudioFormat::SignedInt);
-	format.setByteOrder(QAudioFormat::LittleEndian);
-	format.setCodec("audio/pcm");
-
-	QAudioDeviceInfo info(QAudioDeviceInfo::defaultOutputDevice());
-	if (!info.isFormatSupported(format)) {
-		qWarning() << "Synth output format not supported, trying nearest";
-		format = info.nearestFormat(format);
-	}
-	m_player = new QAudioOutput(format, this);
+	m_player = new QAudioOutput(synthFormat(), this);
 	m_player->setVolume(1.0f);
 	//m_player->setNotifyInterval(100);
 	//connect(m_player, SIGNAL(notify()), this, SLOT(debugDumpStats()));
@@ -1,8 +1,9 @@
 #pragma once
 #include <string>
-#include <QThread>
+#include <vector>
+#include <memory>
+#include <QIODevice>
 #include <QMutex>
-#include <QWaitCondition>
 #include <QBuffer>
 #include <QFile>
 #include <QAudioOutput>
@@ -13,61 +14,106 @@
 struct SynthNote {
 	SynthNote(): note(24), begin(), length() {}
 	SynthNote(const Note& n): note(n.note), begin(n.begin), length(n.length()) {}
-	bool operator<(const SynthNote& rhs) { return begin < rhs.begin; }
+	bool operator<(const SynthNote& rhs) const { return begin < rhs.begin; }
 	int note;
 	double begin;
 	double length;
 };
 
 typedef QList<SynthNote> SynthNotes;
+/// Immutable snapshot of the notes, ordered by begin time (replaced as a whole, never modified)
+typedef std::shared_ptr<const SynthNotes> SynthNotesSnapshot;
 
 /**
- * @brief Threaded WAV buffer creator.
+ * @brief Note synthesizer that plays one continuous stream.
  *
- * Synthesizes and schedules notes in a thread and sends them to the main thread when its time to play them.
+ * Synth is the QIODevice a single QAudioOutput pulls from for as long as the
+ * synth exists. Notes are mixed into the stream (overlapping notes sound
+ * together) and each starts at the sample that corresponds to its begin time:
+ * tick() reports the playback position, which is locked to the stream position
+ * processed by the audio device. Between ticks the device clock is followed.
+ *
+ * The notes are read from a snapshot published by setNotes(), so the audio
+ * rendering never waits for the editor to copy them. Rendering a block starts
+ * the notes beginning within it, walking the snapshot with a cursor.
  */
-class Synth: public QThread
+class Synth: public QIODevice
 {
 	Q_OBJECT
 public:
 	static const int SampleRate = 22050; ///< Sample rate
 
-	Synth(QObject *parent = NULL) : QThread(parent), m_delay(), m_pos(), m_rate(1.0), m_noteBegin(), m_curBuffer(), m_quit()
-	{
-		qRegisterMetaType<QByteArray>("QByteArray"); // Register type for use with queued connections
-	}
-	~Synth() { stop(); wait(); }
+	/// Timing statistics (seconds)
+	struct Stats {
+		Stats(): latency(), jitter(), maxClockError(), notes(), lateNotes() {}
+		double latency; ///< Audio rendered ahead of the audio device
+		double jitter; ///< Mean difference between the reported and expected playback positions
+		double maxClockError; ///< Largest such difference (not counting seeks)
+		unsigned notes; ///< Notes played
+		unsigned lateNotes; ///< Notes started after their begin sample (their begin was reported too late)
+	};
+
+	Synth(QObject *parent = NULL);
+	~Synth() { stop(); }
 
-	/// Updates the synth
-	void tick(qint64 pos, qreal playbackRate, const SynthNotes& notes);
+	/// Replace the notes to play (ordered by begin time)
+	void setNotes(const SynthNotes& notes);
+	/// Updates the playback position
+	void tick(qint64 pos, qreal playbackRate);
 	/// Stop synthesizing
 	void stop();
-	/// Creates the sound
+	Stats stats() const;
+	/// Creates the sound of a single pitch class (0..11)
 	static void createBuffer(QByteArray &buffer, int note, double length);
+	/// Render the notes offline (mono, samples at rate from song time 0), in parallel chunks
+	static std::vector<float> render(const SynthNotes& notes, unsigned rate, std::size_t samples);
+	/// WAV header writer
+	static std::string writeWavHeader(unsigned bits, unsigned ch, unsigned sr, unsigned samples);
 
-signals:
-	void playBuffer(const QByteArray&);
+	bool isSequential() const { return true; }
+	qint64 bytesAvailable() const;
 
 protected:
-	/// Thread runs here
-	void run();
+	qint64 readData(char *data, qint64 maxSize);
+	qint64 writeData(const char*, qint64) { return -1; }
 
 private:
-	/// Calculates the next values
-	void calcNext();
-	/// WAV header writer
-	static std::string writeWavHeader(unsigned bits, unsigned ch, unsigned sr, unsigned samples);
+	/// A sounding note: wavetable oscillator with an ADSR envelope
+	struct Voice {
+		Voice(int note, quint64 beginSample, quint64 endSample, unsigned rate = SampleRate);
+		/// Mix the samples first..last-1 (stream positions) into out[0..last-first-1], in order without gaps
+		void render(float *out, quint64 first, quint64 last);
+		/// Continue rendering from stream sample pos instead (within the note)
+		void seek(quint64 pos) { phase = quint32(quint64(step) * (pos - begin)); }
+		/// Envelope level before the release, offset samples from the note beginning
+		float envelope(quint64 offset) const;
+		quint64 begin, end; ///< Stream samples
+		const float *table; ///< Single cycle of the timbre of the pitch class
+		quint32 phase, step; ///< Position in the cycle and increment per sample (32 bit fixed point)
+		quint32 attack, decay, release; ///< Envelope segment lengths in samples
+	};
+
+	double sampleToTime(double sample) const { return m_anchorTime + (sample - m_anchorSample) / SampleRate * m_rate; }
+	double timeToSample(double time) const { return m_anchorSample + (time - m_anchorTime) / m_rate * SampleRate; }
+	/// Stream position the audio device has processed
+	double playedSample() const;
+	/// Start voices for the notes beginning before stream sample until
+	void schedule(quint64 until);
 
-	SynthNotes m_notes; ///< Notes to synthesize
-	double m_delay; ///< How many seconds until the next sound must be played
-	double m_pos; ///< Position where we are now
+	SynthNotesSnapshot m_notes; ///< Notes to synthesize (accessed atomically)
+	SynthNotesSnapshot m_cursorNotes; ///< Snapshot m_cursor refers to
+	int m_cursor; ///< First note of m_cursorNotes not started yet (-1 = find again)
+	std::vector<Voice> m_voices; ///< Notes being played
+	double m_anchorSample, m_anchorTime; ///< Stream sample and song time that correspond to each other
 	double m_rate; ///< Music playback speed multiplier
-	double m_noteBegin; ///< Position of the next note
-	QByteArray m_soundData[2]; ///< The WAV buffers
-	int m_curBuffer; ///< Which buffer we are currently using
-	bool m_quit; ///< Flag to signal the thread should quit
-	QMutex m_mutex; ///< Mutex for protecting resource access
-	QWaitCondition m_condition; ///< For signaling the thread
+	double m_scheduled; ///< Song time up to which the notes have been started
+	bool m_synced; ///< Has the stream been locked to the playback position?
+	quint64 m_rendered; ///< Samples produced so far
+	Stats m_stats;
+	double m_errorSum;
+	unsigned m_errorCount;
+	QAudioOutput *m_output;
+	mutable QMutex m_mutex; ///< Mutex for protecting resource access
 };
 
 
@@ -26,6 +26,7 @@
 #include <QVBoxLayout>
 #include <QByteArray>
 #include <QFile>
+#include "textencoding.hh"
 
 #include <iostream>
 
@@ -92,25 +93,7 @@ public:
 
 	static QString readAllAndHandleEncoding(QFile &file, QWidget *parent = 0)
 	{
-		QString data = "";
-		QByteArray ba = file.readAll();
-		if (!ba.isEmpty()) {
-			data = QString::fromUtf8(ba, ba.size());
-			if (data.toUtf8().size() != ba.size()) {
-				// Not UTF-8 :(
-				data = QString::fromLatin1(ba, ba.size());
-				if (data.toLatin1().size() != ba.size()) {
-					// Not Latin1 :(
-					data = QString::fromLocal8Bit(ba, ba.size());
-					if (data.toLocal8Bit().size() != ba.size()) {
-						// Not Local 8-bit :(
-						QTextCodec* codec = codecForContent(ba, parent);
-						if (codec) data = codec->toUnicode(ba);
-					}
-				}
-			}
-		}
-		return data;
+		return decodeText(file.readAll(), [parent](QByteArray const& ba) { return codecForContent(ba, parent); });
 	}
 
 private:
@@ -0,0 +1,24 @@
+#include "textencoding.hh"
+#include <QTextCodec>
+
+QString decodeText(QByteArray const& ba, CodecSelector const& select)
+{
+	QString data = "";
+	if (!ba.isEmpty()) {
+		data = QString::fromUtf8(ba, ba.size());
+		if (data.toUtf8().size() != ba.size()) {
+			// Not UTF-8 :(
+			data = QString::fromLatin1(ba, ba.size());
+			if (data.toLatin1().size() != ba.size()) {
+				// Not Latin1 :(
+				data = QString::fromLocal8Bit(ba, ba.size());
+				if (data.toLocal8Bit().size() != ba.size() && select) {
+					// Not Local 8-bit :(
+					QTextCodec* codec = select(ba);
+					if (codec) data = codec->toUnicode(ba);
+				}
+			}
+		}
+	}
+	return data;
+}
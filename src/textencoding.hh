@@ -0,0 +1,13 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <functional>
+
+class QTextCodec;
+
+/// Chooses the codec for text that is neither UTF-8, Latin-1 nor in the local 8-bit encoding (NULL = none)
+typedef std::function<QTextCodec* (QByteArray const& content)> CodecSelector;
+
+/// Decode text of unknown encoding, trying UTF-8, Latin-1 and the local 8-bit encoding before asking select
+QString decodeText(QByteArray const& ba, CodecSelector const& select = CodecSelector());
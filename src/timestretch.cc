@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cmath>
+#include "libda/fft.hpp"
+#include "timestretch.hh"
+
+namespace {
+	const unsigned FFT_P = 12; // FFT size for the correlation, must fit window + 2 * tolerance
+	const std::size_t FFT_N = 1 << FFT_P;
+	const std::size_t window = 2048; // Segment length (43 ms at 48 kHz)
+	const std::size_t hop = window / 2; // Output hop (windows overlap by half)
+	const long tolerance = 512; // Search range around the nominal position (covers voice pitch periods)
+}
+
+const std::size_t TimeStretch::lookahead = window + hop + 2 * tolerance;
+
+TimeStretch::TimeStretch(): m_window(window), m_target(FFT_N), m_search(FFT_N)
+{
+	// Periodic Hann: windows at half overlap sum to exactly one
+	for (std::size_t i = 0; i < window; ++i) m_window[i] = 0.5 - 0.5 * std::cos(2.0 * M_PI * i / window);
+	reset();
+}
+
+void TimeStretch::reset()
+{
+	m_in.clear();
+	m_inBegin = 0;
+	m_finished = false;
+	m_rate = 1.0;
+	m_nominal = 0.0;
+	m_prev = -1;
+	m_ola.assign(window * channels, 0.0f);
+	m_out.assign(hop * channels, 0.0f);
+	m_outRead = hop;
+	m_outPos = 0.0;
+	m_outRate = 1.0;
+}
+
+void TimeStretch::input(std::vector<da::sample_t> const& pcm)
+{
+	m_in.insert(m_in.end(), pcm.begin(), pcm.end());
+}
+
+double TimeStretch::buffered() const
+{
+	return inputEnd() - m_nominal;
+}
+
+bool TimeStretch::done() const
+{
+	return m_finished && m_outRead == hop && m_nominal >= inputEnd();
+}
+
+double TimeStretch::position() const
+{
+	if (m_outRead < hop) return m_outPos + m_outRead * m_outRate;
+	// The next hop starts where the previous segment continues
+	return m_nominal + hop * (1.0 - m_rate);
+}
+
+da::sample_t TimeStretch::sample(long frame, unsigned ch) const
+{
+	if (frame < m_inBegin || frame >= inputEnd()) return 0.0f;
+	return m_in[(frame - m_inBegin) * channels + ch];
+}
+
+std::size_t TimeStretch::output(da::sample_t *out, std::size_t frames, double rate)
+{
+	m_rate = rate;
+	std::size_t rendered = 0;
+	while (rendered < frames) {
+		if (m_outRead == hop && !step()) break;
+		std::size_t n = std::min(frames - rendered, hop - m_outRead);
+		std::copy(m_out.begin() + m_outRead * channels, m_out.begin() + (m_outRead + n) * channels, out + rendered * channels);
+		m_outRead += n;
+		rendered += n;
+	}
+	return rendered;
+}
+
+bool TimeStretch::step()
+{
+	long pos = std::lround(m_nominal);
+	if (m_finished ? pos >= inputEnd() : pos + long(lookahead) > inputEnd()) return false;
+
+	// Where the previous segment naturally continues, pos itself at normal speed
+	long seg = pos;
+	if (m_prev >= 0 && m_prev + long(hop) != pos) seg = bestMatch(pos);
+
+	for (long i = 0; i < long(window); ++i)
+		for (unsigned ch = 0; ch < channels; ++ch)
+			m_ola[i * channels + ch] += m_window[i] * sample(seg + i, ch);
+	// The first half is now complete
+	std::copy(m_ola.begin(), m_ola.begin() + hop * channels, m_out.begin());
+	std::copy(m_ola.begin() + hop * channels, m_ola.end(), m_ola.begin());
+	std::fill(m_ola.begin() + hop * channels, m_ola.end(), 0.0f);
+	m_outRead = 0;
+	m_outPos = m_nominal + hop * (1.0 - m_rate);
+	m_outRate = m_rate;
+
+	m_prev = seg;
+	m_nominal += hop * m_rate;
+	// Drop input that neither the next continuation nor the next search can reach
+	long keep = std::min(m_prev + long(hop), std::lround(m_nominal) - tolerance);
+	if (keep > m_inBegin) {
+		std::size_t drop = std::min<std::size_t>(keep - m_inBegin, m_in.size() / channels);
+		m_in.erase(m_in.begin(), m_in.begin() + drop * channels);
+		m_inBegin += drop;
+	}
+	return true;
+}
+
+long TimeStretch::bestMatch(long pos)
+{
+	// Cross-correlate (mono) the natural continuation of the previous segment against the search range
+	long target = m_prev + long(hop);
+	long begin = std::max(pos - tolerance, m_inBegin);
+	long range = window + 2 * tolerance;
+	for (long i = 0; i < long(FFT_N); ++i) {
+		m_target[i] = i < long(window) ? sample(target + i, 0) + sample(target + i, 1) : 0.0f;
+		m_search[i] = i < range ? sample(begin + i, 0) + sample(begin + i, 1) : 0.0f;
+	}
+	da::fft<FFT_P>(&m_target[0]);
+	da::fft<FFT_P>(&m_search[0]);
+	// Inverse transform of conj(T) * S through the forward one (ifft(X) = conj(fft(conj(X))) / N, only the real part is used)
+	for (std::size_t i = 0; i < FFT_N; ++i) m_search[i] = std::conj(std::conj(m_target[i]) * m_search[i]);
+	da::fft<FFT_P>(&m_search[0]);
+
+	// Sliding energy of the candidates, so that loud segments are not favoured
+	double energy = 0.0;
+	for (long i = 0; i < long(window); ++i) energy += da::math::sqr(sample(begin + i, 0) + sample(begin + i, 1));
+	long best = 0;
+	double bestScore = -HUGE_VAL;
+	for (long l = 0; l <= 2 * tolerance; ++l) {
+		if (l > 0) {
+			energy += da::math::sqr(sample(begin + l + long(window) - 1, 0) + sample(begin + l + long(window) - 1, 1));
+			energy -= da::math::sqr(sample(begin + l - 1, 0) + sample(begin + l - 1, 1));
+		}
+		double score = m_search[l].real() / std::sqrt(std::max(energy, 1e-9));
+		if (score > bestScore) { bestScore = score; best = l; }
+	}
+	return begin + best;
+}
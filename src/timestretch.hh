@@ -0,0 +1,63 @@
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+#include "libda/sample.hpp"
+
+/**
+ * @brief Pitch-preserving time-stretch of interleaved stereo audio (WSOLA).
+ *
+ * Hann windowed segments of the input are overlap-added at a fixed synthesis
+ * hop while the input advances by the hop times the playback rate. Each segment
+ * is taken within a small tolerance of that nominal position, where it best
+ * continues the previous segment (cross-correlation computed through FFT), so
+ * the waveform stays continuous and its pitch is kept.
+ *
+ * Positions are in input frames counted from reset().
+ */
+class TimeStretch
+{
+public:
+	static const unsigned channels = 2;
+	/// Input frames needed beyond the nominal position to render a hop
+	static const std::size_t lookahead;
+
+	TimeStretch();
+	/// Forget all input and output (e.g. after seeking)
+	void reset();
+	/// Append decoded input (interleaved stereo)
+	void input(std::vector<da::sample_t> const& pcm);
+	/// No more input will follow (the rest is played out, padded with silence)
+	void finish() { m_finished = true; }
+	/// Input frames buffered ahead of the nominal position
+	double buffered() const;
+	/// Render up to frames of interleaved output, returns the number rendered (fewer when out of input)
+	std::size_t output(da::sample_t *out, std::size_t frames, double rate);
+	/// Input position heard at the next output frame
+	double position() const;
+	/// All input has been played out
+	bool done() const;
+
+private:
+	/// Render the next hop into m_out, false if more input is needed
+	bool step();
+	/// Start of the segment within the tolerance of pos that best continues the previous one
+	long bestMatch(long pos);
+	da::sample_t sample(long frame, unsigned ch) const;
+	long inputEnd() const { return m_inBegin + long(m_in.size() / channels); }
+
+	std::vector<da::sample_t> m_in; ///< Buffered input
+	long m_inBegin; ///< Position of m_in[0]
+	bool m_finished;
+	double m_rate; ///< Rate of the following hops
+	double m_nominal; ///< Nominal position of the next segment
+	long m_prev; ///< Start of the previous segment (-1 = none)
+	std::vector<da::sample_t> m_ola; ///< Overlap-add accumulator (one window)
+	std::vector<da::sample_t> m_out; ///< Completed hop
+	std::size_t m_outRead; ///< Frames of m_out already returned
+	double m_outPos; ///< Input position heard at m_out[0]
+	double m_outRate; ///< Rate m_out was rendered at
+	std::vector<float> m_window;
+	std::vector<std::complex<float> > m_target, m_search; ///< FFT buffers
+};